@@ -0,0 +1,189 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2022  Ammar Ratnani <ammrat13@gmail.com>
+//
+// Allocation throughput for pmalloc, against malloc and a trivial bump arena.
+// Varies the object size, the alignment, and the number of threads.
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "pmalloc/pmalloc.h"
+#include "pmalloc/inline.h"
+#include "bench.h"
+
+#if defined(PMALLOC_PTHREADS)
+#   include <pthread.h>
+#endif
+
+#define ALLOCS_PER_THREAD 1000000
+
+/** \brief Which allocator to measure */
+typedef enum allocator_t {
+    ALLOCATOR_PMALLOC,
+    ALLOCATOR_PMALLOC_TCACHE,
+    ALLOCATOR_PMALLOC_INLINE,
+    ALLOCATOR_MALLOC,
+    ALLOCATOR_ARENA,
+} allocator_t;
+
+static const char *const allocator_names[] = {
+    "pmalloc", "pmalloc-tcache", "pmalloc-inline", "malloc", "arena",
+};
+
+/** \brief What each thread needs to run */
+typedef struct job_t {
+    allocator_t allocator;
+    pmalloc_pool_t *pool;
+    size_t count;
+    size_t size;
+    size_t align;
+} job_t;
+
+/** \brief The trivial arena
+ *
+ * It's a single buffer with a bump pointer, with no locking and no way to
+ * protect it. It's a lower bound on the cost of allocation.
+ */
+static void *arena_align(char **bp, size_t size, size_t align) {
+    const uintptr_t ret =
+        ((uintptr_t) *bp - size) & ~(uintptr_t) ((1ull << align) - 1);
+    *bp = (char *) ret;
+    return (void *) ret;
+}
+
+/** \brief Allocate with the inline fast path
+ *
+ * This is always inlined, so each call below gets a constant alignment, like
+ * real callers would.
+ */
+__attribute__((always_inline)) static inline void run_inline(
+    const job_t *job,
+    size_t align
+) {
+    for (size_t i = 0; i < job->count; i++) {
+        bench_escape(pmalloc_inline_align(job->pool, job->size, align));
+    }
+}
+
+static void *run_job(void *arg) {
+    const job_t *const job = arg;
+    switch (job->allocator) {
+    case ALLOCATOR_PMALLOC:
+    case ALLOCATOR_PMALLOC_TCACHE:
+        for (size_t i = 0; i < job->count; i++) {
+            bench_escape(pmalloc_align(job->pool, job->size, job->align));
+        }
+        break;
+    case ALLOCATOR_PMALLOC_INLINE:
+        switch (job->align) {
+        case 0: run_inline(job, 0); break;
+        case 3: run_inline(job, 3); break;
+        case 6: run_inline(job, 6); break;
+        default: run_inline(job, job->align); break;
+        }
+        break;
+    case ALLOCATOR_MALLOC: {
+        // Free everything at the end, like destroying a pool would. Only
+        // use the slower aligned allocation if we have to.
+        void **const ptrs = malloc(job->count * sizeof(void *));
+        for (size_t i = 0; i < job->count; i++) {
+            if (job->align <= 3) {
+                ptrs[i] = malloc(job->size);
+            } else {
+                int ret = posix_memalign(
+                    &ptrs[i], 1ull << job->align, job->size);
+                assert(ret == 0);
+                (void) ret;
+            }
+            bench_escape(ptrs[i]);
+        }
+        for (size_t i = 0; i < job->count; i++) {
+            free(ptrs[i]);
+        }
+        free(ptrs);
+        break;
+    }
+    case ALLOCATOR_ARENA: {
+        const size_t arena_size =
+            job->count * (job->size + (1ull << job->align));
+        char *const arena = malloc(arena_size);
+        char *bp = arena + arena_size;
+        for (size_t i = 0; i < job->count; i++) {
+            bench_escape(arena_align(&bp, job->size, job->align));
+        }
+        free(arena);
+        break;
+    }
+    }
+    return NULL;
+}
+
+static void run(
+    allocator_t allocator,
+    size_t threads,
+    size_t count,
+    size_t size,
+    size_t align
+) {
+    pmalloc_pool_t *pool = NULL;
+    if (allocator == ALLOCATOR_PMALLOC
+            || allocator == ALLOCATOR_PMALLOC_TCACHE
+            || allocator == ALLOCATOR_PMALLOC_INLINE) {
+        pmalloc_pool_attr_t attr;
+        pmalloc_pool_attr_init(&attr);
+        if (allocator == ALLOCATOR_PMALLOC_TCACHE) {
+            attr.flags |= PMALLOC_POOL_THREAD_CACHE;
+        }
+        pool = pmalloc_create_attr_pool(&attr);
+    }
+    job_t job = {allocator, pool, count, size, align};
+
+    const double start = bench_now();
+    #if defined(PMALLOC_PTHREADS)
+        pthread_t tids[threads];
+        for (size_t t = 0; t < threads; t++) {
+            pthread_create(&tids[t], NULL, run_job, &job);
+        }
+        for (size_t t = 0; t < threads; t++) {
+            pthread_join(tids[t], NULL);
+        }
+    #else
+        run_job(&job);
+    #endif
+    const double seconds = bench_now() - start;
+
+    if (pool != NULL) {
+        pmalloc_destroy_pool(pool);
+    }
+    bench_row(
+        "alloc", allocator_names[allocator], threads, size, align,
+        threads * count, seconds);
+}
+
+
+int main(int argc, char **argv) {
+    const size_t count = bench_scale(argc, argv, ALLOCS_PER_THREAD);
+    #if defined(PMALLOC_PTHREADS)
+        static const size_t thread_counts[] = {1, 2, 4, 8};
+    #else
+        static const size_t thread_counts[] = {1};
+    #endif
+    static const size_t sizes[] = {8, 64, 512};
+    static const size_t aligns[] = {0, 3, 6};
+
+    bench_header();
+    for (size_t a = 0; a < sizeof(allocator_names) / sizeof(char *); a++) {
+        for (size_t t = 0; t < sizeof(thread_counts) / sizeof(size_t); t++) {
+            // The trivial arena isn't thread-safe
+            if (a == ALLOCATOR_ARENA && thread_counts[t] != 1) {
+                continue;
+            }
+            for (size_t s = 0; s < sizeof(sizes) / sizeof(size_t); s++) {
+                for (size_t l = 0; l < sizeof(aligns) / sizeof(size_t); l++) {
+                    run(a, thread_counts[t], count, sizes[s], aligns[l]);
+                }
+            }
+        }
+    }
+    return 0;
+}
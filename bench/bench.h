@@ -0,0 +1,78 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2022  Ammar Ratnani <ammrat13@gmail.com>
+/** \file
+ *  \brief Helpers shared by all the benchmarks
+ *
+ * Every benchmark prints its results to standard output as CSV, with a header
+ * and then one row per measurement. The columns are the same for all of them.
+ * Parameters that don't apply to a benchmark are zero.
+ */
+
+#ifndef PMALLOC_BENCH_H_
+#define PMALLOC_BENCH_H_
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/** \brief Current time in seconds, from a monotonic clock */
+static inline double bench_now(void) {
+    struct timespec ts;
+    int ret = clock_gettime(CLOCK_MONOTONIC, &ts);
+    assert(ret == 0);
+    (void) ret;
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/** \brief Print the CSV header */
+static inline void bench_header(void) {
+    printf("benchmark,allocator,threads,size,align,count,seconds,per_second\n");
+}
+
+/** \brief Print one measurement
+ *
+ * \param benchmark What was measured
+ * \param allocator What it was measured on
+ * \param count How many operations were done
+ * \param seconds How long they took in total
+ */
+static inline void bench_row(
+    const char *benchmark,
+    const char *allocator,
+    size_t threads,
+    size_t size,
+    size_t align,
+    size_t count,
+    double seconds
+) {
+    printf(
+        "%s,%s,%zu,%zu,%zu,%zu,%.9f,%.1f\n",
+        benchmark, allocator, threads, size, align, count, seconds,
+        count / seconds);
+}
+
+/** \brief Scale the amount of work done from the first argument
+ *
+ * The benchmarks do a fixed amount of work by default. Passing a number as the
+ * first argument divides it, which is useful for quick runs.
+ */
+static inline size_t bench_scale(int argc, char **argv, size_t work) {
+    if (argc < 2) {
+        return work;
+    }
+    const uint64_t div = strtoull(argv[1], NULL, 10);
+    if (div == 0 || div > work) {
+        return 1;
+    }
+    return work / div;
+}
+
+/** \brief Keep the compiler from optimizing away a pointer */
+static inline void bench_escape(void *p) {
+    __asm__ volatile("" : : "g"(p) : "memory");
+}
+
+#endif  // PMALLOC_BENCH_H_
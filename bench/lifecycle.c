@@ -0,0 +1,45 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2022  Ammar Ratnani <ammrat13@gmail.com>
+//
+// Cost of short-lived pools: create one, allocate a few objects, optionally
+// protect it, then destroy it.
+
+#include "pmalloc/pmalloc.h"
+#include "bench.h"
+
+#define POOLS 100000
+
+
+static void run(const char *name, unsigned flags, bool protect, size_t pools) {
+    const double start = bench_now();
+    for (size_t i = 0; i < pools; i++) {
+        pmalloc_pool_attr_t attr;
+        pmalloc_pool_attr_init(&attr);
+        attr.flags |= flags;
+        pmalloc_pool_t *const pool = pmalloc_create_attr_pool(&attr);
+        for (size_t j = 0; j < 16; j++) {
+            bench_escape(pmalloc(pool, 32));
+        }
+        if (protect) {
+            pmalloc_protect_pool(pool);
+        }
+        pmalloc_destroy_pool(pool);
+    }
+    bench_row(
+        protect ? "create-protect-destroy" : "create-destroy", name,
+        1, 32, 0, pools, bench_now() - start);
+}
+
+
+int main(int argc, char **argv) {
+    const size_t pools = bench_scale(argc, argv, POOLS);
+
+    bench_header();
+    for (int protect = 0; protect < 2; protect++) {
+        run("pmalloc", 0, protect, pools);
+        run("pmalloc-arena", PMALLOC_POOL_ARENA, protect, pools);
+        run("pmalloc-external-headers", PMALLOC_POOL_EXTERNAL_HEADERS,
+            protect, pools);
+    }
+    return 0;
+}
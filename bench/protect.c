@@ -0,0 +1,48 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2022  Ammar Ratnani <ammrat13@gmail.com>
+//
+// Latency of pmalloc_protect_pool() against how many pages need sealing, with
+// pages mapped separately and taken from an arena. The number of pages is in
+// the size column.
+
+#include "pmalloc/pmalloc.h"
+#include "bench.h"
+
+#define REPETITIONS 100
+
+
+static void run(const char *name, unsigned flags, size_t pages, size_t reps) {
+    double total = 0.0;
+    for (size_t r = 0; r < reps; r++) {
+        pmalloc_pool_attr_t attr;
+        pmalloc_pool_attr_init(&attr);
+        attr.flags |= flags;
+        pmalloc_pool_t *const pool = pmalloc_create_attr_pool(&attr);
+        // Fill each page almost completely with one object, so each object
+        // gets its own page and each page is fully sealed
+        for (size_t p = 0; p < pages; p++) {
+            char *const x = pmalloc_align(pool, attr.page_size - 64, 0);
+            *x = 'A';
+        }
+
+        const double start = bench_now();
+        pmalloc_protect_pool(pool);
+        total += bench_now() - start;
+
+        pmalloc_destroy_pool(pool);
+    }
+    bench_row("protect", name, 1, pages, 0, reps, total);
+}
+
+
+int main(int argc, char **argv) {
+    const size_t reps = bench_scale(argc, argv, REPETITIONS);
+    static const size_t page_counts[] = {1, 16, 256, 4096};
+
+    bench_header();
+    for (size_t p = 0; p < sizeof(page_counts) / sizeof(size_t); p++) {
+        run("pmalloc", 0, page_counts[p], reps);
+        run("pmalloc-arena", PMALLOC_POOL_ARENA, page_counts[p], reps);
+    }
+    return 0;
+}
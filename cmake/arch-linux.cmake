@@ -15,6 +15,78 @@ cmake_dependent_option(
   OFF
 )
 
+cmake_dependent_option(
+  PMALLOC_THP
+  "Map large pages aligned to transparent huge pages and advise their use"
+  OFF "PMALLOC_LINUX; PMALLOC_ROUND_PAGESIZE; NOT PMALLOC_HUGETLB"
+  OFF)
+cmake_dependent_option(
+  PMALLOC_THP_COLLAPSE
+  "Ask the kernel to collapse protected memory into huge pages immediately"
+  OFF "PMALLOC_THP"
+  OFF)
+if(PMALLOC_THP)
+  set(
+    PMALLOC_THP_SIZE 2097152
+    CACHE STRING "The size of a transparent huge page in bytes")
+endif()
+
+
+cmake_dependent_option(
+  PMALLOC_PAGE_CACHE
+  "Keep freed pages around for reuse instead of unmapping them"
+  ON "PMALLOC_LINUX"
+  OFF)
+cmake_dependent_option(
+  PMALLOC_PAGE_CACHE_LAZYFREE
+  "Release cached pages with MADV_FREE instead of MADV_DONTNEED"
+  OFF "PMALLOC_PAGE_CACHE"
+  OFF)
+if(PMALLOC_PAGE_CACHE)
+  set(
+    PMALLOC_PAGE_CACHE_MAXBYTES 67108864
+    CACHE STRING "Default limit on the number of bytes in the page cache")
+endif()
+
+
+# Creating files with no name needs glibc 2.27 or later
+include(CheckSymbolExists)
+set(CMAKE_REQUIRED_DEFINITIONS -D_GNU_SOURCE)
+check_symbol_exists(memfd_create "sys/mman.h" PMALLOC_HAVE_MEMFD_CREATE)
+unset(CMAKE_REQUIRED_DEFINITIONS)
+cmake_dependent_option(
+  PMALLOC_MEMFD
+  "Back pools with memory files so they can be mapped more than once"
+  ON "PMALLOC_LINUX; PMALLOC_HAVE_MEMFD_CREATE"
+  OFF)
+
+# Protection keys also need glibc 2.27. Whether the CPU has them is checked at
+# runtime.
+set(CMAKE_REQUIRED_DEFINITIONS -D_GNU_SOURCE)
+check_symbol_exists(pkey_alloc "sys/mman.h" PMALLOC_HAVE_PKEY_ALLOC)
+unset(CMAKE_REQUIRED_DEFINITIONS)
+cmake_dependent_option(
+  PMALLOC_PKEYS
+  "Seal pages with a memory protection key, so writing to them needs no syscall"
+  OFF "PMALLOC_LINUX; PMALLOC_HAVE_PKEY_ALLOC"
+  OFF)
+
+# NUMA placement makes the system calls itself, so it doesn't need libnuma.
+# Only the kernel's headers are needed.
+include(CheckIncludeFile)
+check_include_file("linux/mempolicy.h" PMALLOC_HAVE_MEMPOLICY_H)
+# Finding the current node without a system call needs glibc 2.29
+set(CMAKE_REQUIRED_DEFINITIONS -D_GNU_SOURCE)
+check_symbol_exists(getcpu "sched.h" PMALLOC_HAVE_GETCPU)
+unset(CMAKE_REQUIRED_DEFINITIONS)
+cmake_dependent_option(
+  PMALLOC_NUMA
+  "Place pool pages on NUMA nodes with mbind"
+  ON "PMALLOC_LINUX; PMALLOC_HAVE_MEMPOLICY_H"
+  OFF)
+if(PMALLOC_NUMA AND PMALLOC_HAVE_GETCPU)
+  set(PMALLOC_NUMA_GETCPU ON)
+endif()
 
 if(PMALLOC_HUGETLB)
   if(CMAKE_SYSTEM_VERSION VERSION_LESS "2.6.32")
@@ -22,14 +94,8 @@ if(PMALLOC_HUGETLB)
   endif()
 
   set(
-    PMALLOC_PROC_MOUNT "/proc/"
-    CACHE PATH "Where procfs is mounted")
-  set(
-    PMALLOC_MEMINFO_HUGEPAGE "Hugepagesize:"
-    CACHE STRING "What line to read in /proc/meminfo to find the huge page size")
-  set(
-    PMALLOC_MEMINFO_MAXSIZE 4000
-    CACHE STRING "The maximum size of /proc/meminfo")
+    PMALLOC_HUGETLB_SYSFS "/sys/kernel/mm/hugepages/"
+    CACHE PATH "Where sysfs lists the huge page sizes")
   return()
 endif()
 
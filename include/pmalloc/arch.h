@@ -16,7 +16,9 @@
 #ifndef PMALLOC_ARCH_H_
 #define PMALLOC_ARCH_H_
 
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #include "pmalloc/config.h"
 
@@ -40,6 +42,10 @@
 void *pmalloc_alloc_pool(void);
 /** \brief Free a pmalloc_pool_t */
 void pmalloc_free_pool(void *ptr);
+/** \brief Allocate `size` bytes of other metadata on the "normal" heap */
+void *pmalloc_alloc_heap(size_t size);
+/** \brief Free metadata from pmalloc_alloc_heap() */
+void pmalloc_free_heap(void *ptr);
 
 /**@}*/
 
@@ -50,7 +56,8 @@ void pmalloc_free_pool(void *ptr);
  * abort the program.
  *
  * On Linux, these functions return `MAP_PRIVATE` memory. This means pools
- * cannot be shared between multiple processes, only multiple threads.
+ * cannot be shared between multiple processes, only multiple threads. The
+ * exception is pages committed from a file with pmalloc_commit_fd_page().
  *
  * @{
  */
@@ -58,13 +65,163 @@ void pmalloc_free_pool(void *ptr);
 /** \brief Allocate consecutive pages spanning at least `size` bytes
  * \param [inout] size How many consecutive bytes to reserve. Return the
  *                     size actually allocated.
+ * \param [out] seal_size Set to the smallest unit the region's protection can
+ *                     be changed in. That's the OS page size, unless the
+ *                     region is backed by huge pages.
+ * \param [out] cached Set to whether the pages were reused from the page
+ *                     cache, in which case no system call was made
  * \return Pointer to the start of the memory region allocated
  */
-void *pmalloc_alloc_page(size_t *size);
+void *pmalloc_alloc_page(size_t *size, size_t *seal_size, bool *cached);
 /** \brief Free the pages from `ptr` to `ptr+size-1` */
 void pmalloc_free_page(void *ptr, size_t size);
-/** \brief Mark the pages from `ptr` to `ptr+size-1` as readonly */
-void pmalloc_markro_page(void *ptr, size_t size);
+/** \brief Mark the pages from `ptr` to `ptr+size-1` as readonly
+ * \return Whether the protection was changed
+ */
+bool pmalloc_markro_page(void *ptr, size_t size);
+/** \brief Mark the pages from `ptr` to `ptr+size-1` as writable again
+ *
+ * This undoes pmalloc_markro_page(). The pages must have been allocated or
+ * committed already.
+ *
+ * \return Whether the protection was changed
+ */
+bool pmalloc_markrw_page(void *ptr, size_t size);
+/** \brief Let the calling thread write to read-only pages for a moment
+ *
+ * The pages from `ptr` to `ptr+size-1` must have been marked read only. Writes
+ * are allowed until pmalloc_write_end() is called with the same range. Other
+ * threads might be allowed to write too, depending on the platform.
+ *
+ * With protection keys, this doesn't make any system calls, and it lets the
+ * calling thread write to all read-only pages. Otherwise, it's
+ * pmalloc_markrw_page().
+ *
+ * \return Whether writes are allowed. If not, pmalloc_write_end() mustn't be
+ *         called.
+ */
+bool pmalloc_write_begin(void *ptr, size_t size);
+/** \brief Undo pmalloc_write_begin()
+ * \return Whether the pages are read only again
+ */
+bool pmalloc_write_end(void *ptr, size_t size);
+/** \brief Fault in the pages from `ptr` to `ptr+size-1`
+ *
+ * The pages must be writable. Their contents might be overwritten, so this is
+ * only for pages that haven't been used yet. Afterwards, writing to them won't
+ * page fault.
+ */
+void pmalloc_prefault_page(void *ptr, size_t size);
+/** \brief Give the memory of the pages from `ptr` to `ptr+size-1` back
+ *
+ * The pages stay mapped with the same protection, but their contents are
+ * thrown away. Reading them afterwards might give zeros or anything else, so
+ * this is only for pages with nothing in them. They can be read only.
+ *
+ * \return Whether the memory was released. Some kinds of pages, like huge
+ *         pages, can't always be released partly.
+ */
+bool pmalloc_discard_page(void *ptr, size_t size);
+/** \brief The granularity of protection in bytes
+ *
+ * This is the size of an OS page. Pages returned by pmalloc_alloc_page() are
+ * always aligned to it.
+ */
+size_t pmalloc_get_page_size(void);
+
+/** \brief Reserve address space spanning at least `size` bytes
+ *
+ * The region is reserved, but none of it can be accessed. Parts of it have to
+ * be committed with pmalloc_commit_page() before use. It can only be freed as
+ * a whole with pmalloc_release_page().
+ *
+ * \param [inout] size How many bytes to reserve. Return the size actually
+ *                     reserved.
+ * \return Pointer to the start of the region reserved
+ */
+void *pmalloc_reserve_page(size_t *size);
+/** \brief Make reserved pages readable and writable
+ *
+ * The pages start at `ptr`, which must be page aligned, and span at least
+ * `size` bytes.
+ *
+ * \param [inout] size How many bytes to commit. Return the size actually
+ *                     committed.
+ */
+void pmalloc_commit_page(void *ptr, size_t *size);
+/** \brief Free a region from pmalloc_reserve_page() */
+void pmalloc_release_page(void *ptr, size_t size);
+
+#if defined(PMALLOC_MEMFD) || defined(DOXYGEN)
+/** \brief Create an anonymous file to back pages with
+ * \return The file descriptor of the file
+ */
+int pmalloc_create_fd(void);
+/** \brief Open a file to back pages with
+ *
+ * \param create Whether to create the file, or truncate it if it exists, and
+ *               open it for writing. Otherwise, it's opened read only.
+ * \return The file descriptor of the file, or `-1` if it couldn't be opened
+ */
+int pmalloc_open_fd(const char *path, bool create);
+/** \brief Close a file from pmalloc_create_fd() or pmalloc_open_fd() */
+void pmalloc_close_fd(int fd);
+/** \brief Make reserved pages readable and writable, backed by a file
+ *
+ * This is like pmalloc_commit_page(), but the pages are a shared mapping of
+ * the file `fd` starting at `offset`, which must be page aligned. The file is
+ * grown to cover them if it's too small. The same part of a file can be
+ * committed at more than one address, and writes through one are seen through
+ * all the others.
+ *
+ * \param [inout] size How many bytes to commit. Return the size actually
+ *                     committed.
+ */
+void pmalloc_commit_fd_page(void *ptr, size_t *size, int fd, size_t offset);
+/** \brief Map the start of a file read only
+ *
+ * Unlike the other functions here, this fails gracefully. Another process
+ * chose the address, so something else might already be mapped there.
+ *
+ * \param ptr Where to map the file, or `NULL` to map it anywhere
+ * \param size How many bytes to map. Parts past the end of the file can't be
+ *             accessed until the file grows.
+ * \return Where the file was mapped, or `NULL` if it couldn't be mapped at
+ *         `ptr`
+ */
+void *pmalloc_attach_fd_page(void *ptr, size_t size, int fd);
+/** \brief Write pages from pmalloc_commit_fd_page() back to their file
+ *
+ * This waits until the data is written.
+ */
+void pmalloc_sync_page(void *ptr, size_t size);
+/** \brief Read `size` bytes from the start of a file into `buf`
+ * \return Whether all of them could be read
+ */
+bool pmalloc_read_fd(int fd, void *buf, size_t size);
+#endif
+
+#if defined(PMALLOC_NUMA) || defined(DOXYGEN)
+/** \brief Choose which NUMA nodes pages are put on
+ *
+ * This has to be called before the pages are first touched, since pages that
+ * are already resident aren't moved. It fails silently, say if the kernel
+ * doesn't support NUMA or if `node` doesn't exist, since placement is only a
+ * hint.
+ *
+ * \param policy A `PMALLOC_NUMA_*` value
+ * \param node The node to use with `PMALLOC_NUMA_BIND`
+ */
+void pmalloc_numa_page(void *ptr, size_t size, unsigned policy, int node);
+/** \brief The nodes this process can put memory on
+ * \return A bitmask of the nodes. It's one if it couldn't be found.
+ */
+uint64_t pmalloc_numa_nodes(void);
+/** \brief The node the calling thread is running on
+ * \return The node, or zero if it couldn't be found
+ */
+int pmalloc_numa_node(void);
+#endif
 
 /**@}*/
 
@@ -106,6 +263,69 @@ void pmalloc_unlock_mutex(pmalloc_mutex_t *mutex);
 
 /**@}*/
 
+
+/** \defgroup atomic Atomic Operations
+ *  \brief Lock-free access to fields shared between threads
+ *
+ * Some fields, like the boundary pointer of the head page, are read and written
+ * without holding the pool's lock. These macros access them atomically. Loads
+ * have acquire semantics and stores have release semantics, so a page's fields
+ * are visible to any thread that sees a pointer to it.
+ *
+ * If the library isn't thread-safe, these degrade to plain memory accesses.
+ * Per-thread storage is only available if the library is thread-safe.
+ *
+ * @{
+ */
+
+#if defined(PMALLOC_THREADS) || defined(DOXYGEN)
+
+    /** \brief Atomically load the value at `ptr` */
+#   define PMALLOC_ATOMIC_LOAD(ptr) __atomic_load_n((ptr), __ATOMIC_ACQUIRE)
+    /** \brief Atomically store `val` to `ptr` */
+#   define PMALLOC_ATOMIC_STORE(ptr, val) \
+        __atomic_store_n((ptr), (val), __ATOMIC_RELEASE)
+    /** \brief Atomically replace `*ptr` with `desired` if it is `*expected`
+     *
+     * On failure, `*expected` is updated with the value actually observed.
+     * This may fail spuriously, so it should be used in a loop.
+     *
+     * \return Whether the exchange happened
+     */
+#   define PMALLOC_ATOMIC_CAS(ptr, expected, desired) \
+        __atomic_compare_exchange_n( \
+            (ptr), (expected), (desired), true, \
+            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+    /** \brief Atomically add `val` to `*ptr`, returning the old value
+     *
+     * This doesn't order any other memory accesses. It's meant for counters.
+     */
+#   define PMALLOC_ATOMIC_ADD(ptr, val) \
+        __atomic_fetch_add((ptr), (val), __ATOMIC_RELAXED)
+
+    /** \brief Storage class for variables with one copy per thread */
+#   define PMALLOC_THREAD_LOCAL __thread
+
+#else
+
+#   define PMALLOC_ATOMIC_LOAD(ptr) (*(ptr))
+#   define PMALLOC_ATOMIC_STORE(ptr, val) ((void) (*(ptr) = (val)))
+#   define PMALLOC_ATOMIC_CAS(ptr, expected, desired) \
+        ((*(ptr) == *(expected)) \
+            ? (*(ptr) = (desired), true) \
+            : (*(expected) = *(ptr), false))
+#   define PMALLOC_ATOMIC_ADD(ptr, val) pmalloc_plain_add((ptr), (val))
+
+    static inline size_t pmalloc_plain_add(size_t *ptr, size_t val) {
+        const size_t ret = *ptr;
+        *ptr += val;
+        return ret;
+    }
+
+#endif
+
+/**@}*/
+
 /**@}*/
 
 #endif  // PMALLOC_ARCH_H_
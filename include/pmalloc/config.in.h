@@ -36,6 +36,29 @@
  */
 #cmakedefine PMALLOC_DEFAULT_ALIGNMENT @PMALLOC_DEFAULT_ALIGNMENT@
 
+/** \brief Address space to reserve for a pool's arena if none is specified
+ * \sa PMALLOC_POOL_ARENA
+ */
+#cmakedefine PMALLOC_DEFAULT_ARENASIZE @PMALLOC_DEFAULT_ARENASIZE@
+
+/** \brief Keep statistics about pools and memory use
+ *
+ * If this option is unset, the counters are removed entirely, and all the
+ * statistics read as zero.
+ *
+ * \sa pmalloc_pool_stats()
+ * \sa pmalloc_global_stats()
+ */
+#cmakedefine PMALLOC_STATS
+
+/** \brief Keep a map of every page in the process
+ *
+ * It's what pmalloc_owner() and pmalloc_is_protected() look pointers up in.
+ * Keeping it up to date costs a few stores for each page that's mapped or
+ * freed. If this option is unset, those functions aren't available.
+ */
+#cmakedefine PMALLOC_PAGE_MAP
+
 
 /** \brief Defined if the target platform is Linux (not just UNIX) */
 #cmakedefine PMALLOC_LINUX
@@ -45,15 +68,58 @@
 #   cmakedefine PMALLOC_ROUND_PAGESIZE
     /** \brief Use huge pages */
 #   cmakedefine PMALLOC_HUGETLB
-    /** \brief Where procfs is mounted */
-#   cmakedefine PMALLOC_PROC_MOUNT "@PMALLOC_PROC_MOUNT@"
-    /** \brief What line to read in /proc/meminfo to find the page size */
-#   cmakedefine PMALLOC_MEMINFO_HUGEPAGE "@PMALLOC_MEMINFO_HUGEPAGE@"
-    /** \brief The largest size of /proc/meminfo we can deal with */
-#   cmakedefine PMALLOC_MEMINFO_MAXSIZE @PMALLOC_MEMINFO_MAXSIZE@
+    /** \brief Where sysfs lists the huge page sizes */
+#   cmakedefine PMALLOC_HUGETLB_SYSFS "@PMALLOC_HUGETLB_SYSFS@"
 
     /** \brief Assert that page sizes are exactly their "normal" values */
 #   cmakedefine PMALLOC_AGGRESSIVE_PAGESIZE_CHECKS
+
+    /** \brief Use transparent huge pages */
+#   cmakedefine PMALLOC_THP
+#   if defined(PMALLOC_THP)
+        /** \brief Collapse memory into huge pages when it's protected */
+#       cmakedefine PMALLOC_THP_COLLAPSE
+        /** \brief The size of a transparent huge page */
+#       define PMALLOC_THP_SIZE @PMALLOC_THP_SIZE@
+#   endif
+
+    /** \brief Keep freed pages for reuse instead of unmapping them */
+#   cmakedefine PMALLOC_PAGE_CACHE
+#   if defined(PMALLOC_PAGE_CACHE)
+        /** \brief Release cached pages with `MADV_FREE` */
+#       cmakedefine PMALLOC_PAGE_CACHE_LAZYFREE
+        /** \brief Default limit on the number of bytes in the page cache
+         * \sa pmalloc_set_page_cache_limit()
+         */
+#       define PMALLOC_PAGE_CACHE_MAXBYTES @PMALLOC_PAGE_CACHE_MAXBYTES@
+#   endif
+
+    /** \brief Back pools with memory files so they can be mapped twice
+     * \sa PMALLOC_POOL_WRITE_RARE
+     */
+#   cmakedefine PMALLOC_MEMFD
+
+    /** \brief Seal pages with a memory protection key if the CPU has them
+     *
+     * Sealed pages are tagged with a key that threads can't write to. The
+     * library can then let a thread write to them by changing a register,
+     * without any system calls. The key is allocated by pmalloc_init(). Threads
+     * that already exist then can't read sealed pages at all, so the library
+     * has to be initialized before any threads are started. Signal handlers
+     * can't read them either.
+     */
+#   cmakedefine PMALLOC_PKEYS
+
+    /** \brief Place pool pages on NUMA nodes
+     *
+     * Pages are placed with `mbind`, called directly so that libnuma isn't
+     * needed. On machines with one node, it does nothing useful.
+     *
+     * \sa pmalloc_pool_attr_t::numa_policy
+     */
+#   cmakedefine PMALLOC_NUMA
+    /** \brief Defined if the C library has `getcpu` */
+#   cmakedefine PMALLOC_NUMA_GETCPU
 #endif
 
 
@@ -81,6 +147,11 @@
 #   cmakedefine PMALLOC_PTHREADS
     /** \brief Defined if the thread library found was for Windows */
 #   cmakedefine PMALLOC_WIN32_THREADS
+
+    /** \brief How many bytes a thread takes from a pool at a time
+     * \sa PMALLOC_POOL_THREAD_CACHE
+     */
+#   cmakedefine PMALLOC_THREAD_CACHE_CHUNK @PMALLOC_THREAD_CACHE_CHUNK@
 #endif  // PMALLOC_THREADS
 
 /**@}*/
@@ -0,0 +1,86 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2022  Ammar Ratnani <ammrat13@gmail.com>
+/** \file
+ *  \ingroup public
+ *  \brief Allocation fast path that can be inlined into the caller
+ *
+ * Every call to pmalloc_align() is a call into the library, and through a PLT
+ * entry if it's a shared library. For small objects, that call costs as much
+ * as the allocation itself. This header has a copy of the fast path that's
+ * inlined into the caller instead. It bumps the head page's boundary pointer
+ * directly, and only calls the library when that's not enough, like when a new
+ * page is needed, when the head page is read only, or when the pool has a
+ * thread cache or prefaults its pages.
+ *
+ * It works best when the alignment is a constant. The rounding then compiles
+ * to a single mask. It reads the pool's internals, so code using it has to be
+ * rebuilt whenever the library is.
+ *
+ * @{
+ */
+
+#ifndef PMALLOC_INLINE_H_
+#define PMALLOC_INLINE_H_
+
+#include "pmalloc/pmalloc.h"
+#include "pmalloc/internals.h"
+
+
+/** \brief Allocate memory in a pool, inlining the common case
+ *
+ * This behaves exactly like pmalloc_align(), and can be mixed freely with it.
+ *
+ * \param [in] pool Handle of the pool to allocate memory in
+ * \param size Number of bytes to allocate
+ * \param align The log-base-2 of the alignment needed, ideally a constant
+ * \return Pointer to the allocated memory
+ */
+__attribute__((always_inline)) static inline void *pmalloc_inline_align(
+    pmalloc_pool_t *pool,
+    size_t size,
+    size_t align
+) {
+    #if defined(PMALLOC_THREADS)
+        const unsigned slow_flags =
+            PMALLOC_POOL_THREAD_CACHE | PMALLOC_POOL_PREFAULT;
+    #else
+        const unsigned slow_flags = PMALLOC_POOL_PREFAULT;
+    #endif
+    if (pool == NULL || size == 0 || size > pool->page_size
+            || (pool->flags & slow_flags)) {
+        return pmalloc_align(pool, size, align);
+    }
+
+    // This is pmalloc_bump_head()
+    pmalloc_page_header_t *const head = PMALLOC_ATOMIC_LOAD(&pool->head);
+    if (head != NULL && !PMALLOC_ATOMIC_LOAD(&head->ro)) {
+        const size_t min_page_size =
+            pmalloc_align_up(pool->header_size, align) + size;
+        size_t bp = PMALLOC_ATOMIC_LOAD(&head->bp_offset);
+        while (bp >= min_page_size) {
+            const size_t new_bp = pmalloc_align_down(bp - size, align);
+            if (PMALLOC_ATOMIC_CAS(&head->bp_offset, &bp, new_bp)) {
+                PMALLOC_STAT_ADD(
+                    pool->stats.waste_alignment, bp - size - new_bp);
+                PMALLOC_STAT_ADD(pool->stats.allocations, 1);
+                PMALLOC_STAT_ADD(pool->stats.allocated_bytes, size);
+                return head->base + new_bp;
+            }
+        }
+    }
+    return pmalloc_align(pool, size, align);
+}
+
+#if !defined(__cplusplus) || defined(DOXYGEN)
+/** \brief Calls pmalloc_inline_align() with the default alignment
+ *
+ * Like pmalloc(), this isn't available in C++.
+ */
+static inline void *pmalloc_inline(pmalloc_pool_t *pool, size_t size) {
+    return pmalloc_inline_align(pool, size, PMALLOC_DEFAULT_ALIGNMENT);
+}
+#endif
+
+/**@}*/
+
+#endif  // PMALLOC_INLINE_H_
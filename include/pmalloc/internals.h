@@ -11,6 +11,7 @@
 #define PMALLOC_INTERNALS_H_
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "pmalloc/pmalloc.h"
 #include "pmalloc/arch.h"
@@ -23,8 +24,10 @@ typedef struct pmalloc_page_header_t pmalloc_page_header_t;
  *
  * Each page in the linked list requires some metadata, like the pointer to the
  * next page, the offset of the "base pointer", and whether or not it's read
- * only. This structure contains all that. It's placed at the very start of a
- * page.
+ * only. This structure contains all that. It's normally placed at the very
+ * start of a page. With `PMALLOC_POOL_EXTERNAL_HEADERS`, it's placed in a table
+ * owned by the pool instead, and the page holds only objects. All offsets are
+ * from the start of the page, not of this structure.
  *
  * Allocation within a page goes from high memory to low memory. This is
  * apparently more efficient according to <a
@@ -44,23 +47,162 @@ typedef struct pmalloc_page_header_t pmalloc_page_header_t;
  *
  * Pages are allocated with a platform specific function. It's possible we get
  * more data than we need. Thus, we store the actual size of the page here.
+ *
+ * When a pool is protected, only the OS pages that contain allocated space are
+ * made read only. Any whole OS pages of free space stay writable, and the page
+ * keeps serving allocations from them. To do that, the boundary pointer is
+ * moved down to the start of the OS page it's in. The page is only marked as
+ * read only once the header's OS page is sealed too. Pages backed by huge pages
+ * are sealed a whole huge page at a time instead, since protection can't be
+ * changed for part of one.
+ * <pre>
+ * +--------+-------------+------+----------+------------+
+ * |  Page  |    Free     | Lost | Writable | Read Only  |
+ * | Header |    Space    |      |   Data   |    Data    |
+ * +--------+-------------+------+----------+------------+
+ *                        ^      ^          ^
+ *                    Boundary   OS Page    Read Only
+ *                    Pointer    Boundary   Offset
+ * </pre>
+ *
+ * The boundary pointer and the read-only flag of the head page are accessed
+ * without holding the pool's lock. So is the read-only offset of every page,
+ * by pmalloc_is_protected(). They must only be touched with the atomic
+ * operations in pmalloc/arch.h. All the other fields are only changed while
+ * holding the lock.
  */
 struct pmalloc_page_header_t {
     pmalloc_page_header_t *next;  ///< Next page in the linked list
+    char *base;  ///< The start of the page, where this header normally is
     size_t page_size;  ///< The size of this page in bytes
+    /** \brief The smallest unit this page's protection can be changed in
+     *
+     * This is the OS page size, unless the page is backed by huge pages. Then,
+     * it's their size.
+     */
+    size_t seal_size;
 
     /** \brief "Boundary pointer"'s offset from the start of the page
      *
      * The allocator grows down because it's more efficient to do so. Just as
      * with a stack with its stack pointer, we have a "boundary pointer" that
-     * starts at the end of the page and grows downward.
+     * starts at the end of the page and grows downward. Space is claimed by
+     * compare-and-swapping this value down, so concurrent allocations never
+     * get overlapping ranges.
      */
     size_t bp_offset;
+    /** \brief Offset of the first read-only byte in the page
+     *
+     * Everything from here to the end of the page has been sealed. This is the
+     * page size if nothing has been sealed yet. It's always a multiple of
+     * #seal_size, except when it's the page size.
+     */
+    size_t ro_offset;
 
     bool ro;  ///< Whether this page has (ever) been marked as read only.
+
+#if defined(PMALLOC_PAGE_MAP) || defined(DOXYGEN)
+    /** \brief The pool the page is in, for pmalloc_owner() */
+    pmalloc_pool_t *pool;
+#endif
 };
 
 
+/** \brief How many headers are in each pmalloc_header_table_t */
+#define PMALLOC_HEADER_TABLE_SIZE 64
+
+typedef struct pmalloc_header_table_t pmalloc_header_table_t;
+
+/** \brief Storage for page headers with `PMALLOC_POOL_EXTERNAL_HEADERS`
+ *
+ * Headers are allocated from these tables in order. When one fills up, a new
+ * one is allocated and linked in front of it. Headers are never moved, since
+ * they're read without holding the pool's lock, and they're only freed when
+ * the pool is destroyed.
+ */
+struct pmalloc_header_table_t {
+    pmalloc_header_table_t *next;  ///< The table allocated before this one
+    size_t used;  ///< How many of the headers have been handed out
+    pmalloc_page_header_t headers[PMALLOC_HEADER_TABLE_SIZE];
+};
+
+
+/** \brief How many pages with free space a pool keeps track of
+ * \sa PMALLOC_POOL_BEST_FIT
+ */
+#define PMALLOC_OPEN_PAGES 8
+
+
+/** \brief A contiguous region of address space that pages are carved from
+ *
+ * Pools with `PMALLOC_POOL_ARENA` reserve one large region when they're
+ * created. Pages are committed from the bottom of it in order, so all the pages
+ * of the pool are next to each other. That means they can be protected and
+ * freed with one system call each.
+ * <pre>
+ * +--------+--------+--------+------------------------+
+ * | Page 0 | Page 1 | Page 2 |       Reserved         |
+ * +--------+--------+--------+------------------------+
+ * ^                          ^                        ^
+ * Base                   Committed                  Size
+ * </pre>
+ */
+typedef struct pmalloc_arena_t {
+    char *base;  ///< Start of the region, or `NULL` if there is no arena
+    size_t size;  ///< How many bytes were reserved
+    size_t committed;  ///< How many bytes from the base are used by pages
+#if defined(PMALLOC_MEMFD) || defined(DOXYGEN)
+    /** \brief The file backing the pages, or `-1` if they're anonymous
+     *
+     * With `PMALLOC_POOL_WRITE_RARE`, the committed pages are a mapping of this
+     * file, starting from the beginning.
+     */
+    int fd;
+    /** \brief A second mapping of the pages that's never made read only
+     *
+     * It's reserved and committed alongside the arena, and it has the same
+     * size. It's `NULL` if there's no file.
+     */
+    char *alias;
+#endif
+} pmalloc_arena_t;
+
+/** \brief Whether `ptr` points into the committed part of an arena */
+static inline bool pmalloc_in_arena(const pmalloc_arena_t *arena, void *ptr) {
+    return arena->base != NULL
+        && (char *) ptr >= arena->base
+        && (char *) ptr < arena->base + arena->committed;
+}
+
+
+#if defined(PMALLOC_MEMFD) || defined(DOXYGEN)
+/** \brief The value of pmalloc_superblock_t::magic, which is "pmalloc" */
+#define PMALLOC_SUPERBLOCK_MAGIC UINT64_C(0x636f6c6c616d70)
+
+/** \brief Description of a shared pool, at the start of its file
+ *
+ * Pools with `PMALLOC_POOL_SHARED` commit this at the very start of their
+ * arena, before any pages. Other processes read it from the file to find out
+ * where to map the arena. Pointers in the pool are only valid at the same
+ * address, so it has to be mapped at #base to use them. Files opened with
+ * pmalloc_open_file_pool() can be mapped anywhere, so nothing here is a
+ * pointer into the arena.
+ */
+typedef struct pmalloc_superblock_t {
+    uint64_t magic;  ///< #PMALLOC_SUPERBLOCK_MAGIC
+    char *base;  ///< The address of the arena in the process that made it
+    size_t size;  ///< How many bytes of address space the arena spans
+    /** \brief Offset of the object set with pmalloc_set_root()
+     *
+     * This is zero if there is none, since the superblock is there. Use the
+     * atomic operations in pmalloc/arch.h to access it, since other processes
+     * might be reading it.
+     */
+    size_t root;
+} pmalloc_superblock_t;
+#endif
+
+
 /** \brief Metadata representing a pool
  *
  * Pools require some metadata to function. For instance, a pool needs to know
@@ -72,23 +214,223 @@ struct pmalloc_page_header_t {
  * points to the head of the list.
  */
 struct pmalloc_pool_t {
-    pmalloc_page_header_t *head;  ///< First page in the linked list
+    /** \brief First page in the linked list
+     *
+     * This is read without holding the lock when trying to allocate from the
+     * head page. Use the atomic operations in pmalloc/arch.h to access it.
+     */
+    pmalloc_page_header_t *head;
     size_t page_size;  ///< How much to allocate at once in bytes
+    unsigned flags;  ///< Bitwise OR of `PMALLOC_POOL_*` flags
+
+    /** \brief How many bytes at the start of each page hold its header
+     *
+     * This is zero if the headers are kept in #headers instead.
+     */
+    size_t header_size;
+    /** \brief Where headers are allocated from, if they're not in the page */
+    pmalloc_header_table_t *headers;
+
+    /** \brief Number unique to this pool over the life of the process
+     *
+     * Pools can be allocated at the same address as previously destroyed ones.
+     * This is used instead of the address to tell pools apart.
+     */
+    size_t id;
+    /** \brief How many times this pool has been protected, reset, or rewound
+     *
+     * Threads cache chunks of the pool's pages. They compare this against the
+     * value they saw when they got their chunk to find out whether it's been
+     * made read only, reset, or rewound since. Use the atomic operations in
+     * pmalloc/arch.h to access it.
+     */
+    size_t epoch;
+    /** \brief How many times this pool has been protected or reset
+     *
+     * Unlike #epoch, this doesn't change when the pool is rewound. It's used
+     * to check that a pmalloc_mark_t is still valid. This is only accessed with
+     * the lock held.
+     */
+    size_t generation;
+
+    /** \brief Where to take new pages from, if the pool has an arena
+     *
+     * When the arena runs out of space, new pages are mapped separately as if
+     * the pool didn't have one.
+     */
+    pmalloc_arena_t arena;
+
+    /** \brief Where to put new pages, as a `PMALLOC_NUMA_*` value
+     * \sa pmalloc_pool_attr_t::numa_policy
+     */
+    unsigned numa_policy;
+    int numa_node;  ///< The node for `PMALLOC_NUMA_BIND`
+
+    /** \brief The group whose arena pages are taken from, or `NULL`
+     *
+     * Pools in a group don't have an arena of their own.
+     */
+    pmalloc_group_t *group;
+    /** \brief The next pool in the same group
+     *
+     * This is only accessed with the group's member lock held.
+     */
+    pmalloc_pool_t *group_next;
+
+    /** \brief Pages other than the head that still have room
+     *
+     * This is only used with `PMALLOC_POOL_BEST_FIT`. When a new head page is
+     * linked in, the old one is put here instead of being abandoned. The pages
+     * are sorted by how much free space they have, from least to most. They're
+     * all still in the linked list. This is only accessed with the lock held.
+     */
+    pmalloc_page_header_t *open[PMALLOC_OPEN_PAGES];
+    size_t open_count;  ///< How many of #open are used
+
+    /** \brief Where pmalloc_protect() can stop walking the list
+     *
+     * Nothing can be allocated in this page or any page after it anymore, and
+     * they've all been sealed since their last allocation. It's `NULL` when the
+     * whole list has to be walked. This is only accessed with the lock held.
+     */
+    pmalloc_page_header_t *sealed;
+
+    /** \brief Pages holding a single object too big for a normal page
+     *
+     * These are kept separate from the main list so they never become the head
+     * page. Pages are pushed onto the front of this list with a
+     * compare-and-swap, without holding the lock. Use the atomic operations in
+     * pmalloc/arch.h to access it.
+     */
+    pmalloc_page_header_t *large;
+
+    /** \brief Empty pages to use before mapping new ones
+     *
+     * Pages end up here when the pool is reset or rewound. They're writable,
+     * and all their fields have been reset, so they can be linked in as the
+     * head as they are. They're linked through pmalloc_page_header_t::next.
+     * This is only accessed with the lock held.
+     */
+    pmalloc_page_header_t *spare;
+
+#if defined(PMALLOC_STATS) || defined(DOXYGEN)
+    /** \brief Counters for pmalloc_pool_stats()
+     *
+     * Update them with PMALLOC_STAT_ADD(), since some are updated without
+     * holding the lock.
+     */
+    pmalloc_stats_t stats;
+#endif
 
 #if defined(PMALLOC_THREADS) || defined(DOXYGEN)
     /** \brief Mutual exclusion on the pool
      *
-     * Whenever anyone tries to do any action on the pool, they must hold this
-     * lock. One would think this would be inefficient, and that page-level
-     * locks would be more performant. In reality, since all allocations happen
-     * from the front-most page, that lock just replaces this one. It also leads
-     * to more complexity.
+     * Whenever anyone tries to modify the structure of the pool, they must hold
+     * this lock. That includes linking in new pages and marking pages as read
+     * only. The only exception is bumping the boundary pointer of the head
+     * page, which is done with a compare-and-swap. Allocations that fit in the
+     * head page never take this lock.
      */
     pmalloc_mutex_t mutex;
 #endif
 };
 
 
+/** \brief Pools that share an arena so they can be sealed together
+ *
+ * Member pools commit their pages from the group's arena as they need them, so
+ * pages from different pools end up next to each other. Sealing the whole
+ * group then coalesces them into as few ranges as possible.
+ *
+ * There are two locks. The member lock is taken before any of the members'
+ * locks, and the arena lock after. That way, sealing the group can hold all
+ * the members' locks while members are taking pages from the arena.
+ */
+struct pmalloc_group_t {
+    /** \brief Where members take their pages from
+     *
+     * Pages in it are only freed when the group is destroyed.
+     */
+    pmalloc_arena_t arena;
+    /** \brief The first member, linked through pmalloc_pool_t::group_next */
+    pmalloc_pool_t *members;
+#if defined(PMALLOC_THREADS) || defined(DOXYGEN)
+    pmalloc_mutex_t members_mutex;  ///< Protects #members
+    pmalloc_mutex_t arena_mutex;  ///< Protects #arena
+#endif
+};
+
+
+/** \brief Copies of a pool, one for each NUMA node
+ *
+ * Every node has an entry, so the local copy can be found by indexing. Nodes
+ * that didn't get a pool share the root of the first one that did.
+ */
+struct pmalloc_replicas_t {
+    /** \brief The pool for each node, or `NULL` if it doesn't have one */
+    pmalloc_pool_t *pools[PMALLOC_NUMA_MAXNODES];
+    /** \brief What the build function returned for each node's copy */
+    void *roots[PMALLOC_NUMA_MAXNODES];
+};
+
+
+#if defined(PMALLOC_STATS) || defined(DOXYGEN)
+    /** \brief Process-wide counters for pmalloc_global_stats() */
+    extern pmalloc_global_stats_t pmalloc_global_counters;
+
+    /** \brief Add `val` to a statistics counter
+     *
+     * Counters are only read for statistics, so they don't need to be ordered
+     * with anything else. This compiles to nothing if `PMALLOC_STATS` is unset.
+     */
+#   define PMALLOC_STAT_ADD(counter, val) \
+        ((void) PMALLOC_ATOMIC_ADD(&(counter), (val)))
+    /** \brief Subtract `val` from a statistics counter */
+#   define PMALLOC_STAT_SUB(counter, val) \
+        ((void) PMALLOC_ATOMIC_ADD(&(counter), (size_t) 0 - (val)))
+#else
+#   define PMALLOC_STAT_ADD(counter, val) ((void) 0)
+#   define PMALLOC_STAT_SUB(counter, val) ((void) 0)
+#endif
+
+
+/** \brief Allocate from a pool, bypassing the calling thread's cache
+ *
+ * This is pmalloc_align() without argument checking, and without looking at
+ * the thread cache. It's used to refill the thread cache.
+ */
+void *pmalloc_align_shared(pmalloc_pool_t *pool, size_t size, size_t align);
+
+#if defined(PMALLOC_THREADS) || defined(DOXYGEN)
+/** \brief Allocate from the calling thread's chunk of a pool
+ *
+ * This is only used for pools with `PMALLOC_POOL_THREAD_CACHE`. It refills the
+ * thread's chunk from the pool if needed.
+ *
+ * \return Pointer to the allocated memory, or `NULL` if the allocation has to
+ *         go to the shared pool instead
+ */
+void *pmalloc_tcache_align(pmalloc_pool_t *pool, size_t size, size_t align);
+#endif
+
+
+#if defined(PMALLOC_PAGE_MAP) || defined(DOXYGEN)
+/** \brief Add a page to the process-wide page map
+ *
+ * Pointers anywhere in the page are then found by pmalloc_owner(). All the
+ * page's fields have to be set first, since other threads can look it up as
+ * soon as this writes it. Each OS page belongs to at most one page, so this
+ * doesn't need the pool's lock.
+ */
+void pmalloc_page_map_insert(pmalloc_page_header_t *page);
+/** \brief Remove a page from the process-wide page map
+ *
+ * This has to be called before the page is freed.
+ */
+void pmalloc_page_map_remove(pmalloc_page_header_t *page);
+#endif
+
+
 /** \brief Round down `x` to the nearest multiple of `m` */
 static inline size_t pmalloc_round_down(size_t x, size_t m) {
     return (x / m) * m;
@@ -99,6 +441,20 @@ static inline size_t pmalloc_round_up(size_t x, size_t m) {
     return ((x + m - 1) / m) * m;
 }
 
+/** \brief Round down `x` to a multiple of `1 << align`
+ *
+ * This is pmalloc_round_down() for powers of two. It's a mask rather than a
+ * division, which matters on the allocation path.
+ */
+static inline size_t pmalloc_align_down(size_t x, size_t align) {
+    return x & ~(((size_t) 1 << align) - 1);
+}
+
+/** \brief Round up `x` to a multiple of `1 << align` */
+static inline size_t pmalloc_align_up(size_t x, size_t align) {
+    return pmalloc_align_down(x + ((size_t) 1 << align) - 1, align);
+}
+
 /**@}*/
 
 #endif  // PMALLOC_INTERNALS_H_
@@ -0,0 +1,106 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2022  Ammar Ratnani <ammrat13@gmail.com>
+/** \file
+ *  \ingroup public
+ *  \brief Pointers that stay valid when a pool is mapped somewhere else
+ *
+ * Pools made with pmalloc_create_file_pool() can be mapped at a different
+ * address every time they're opened. Normal pointers between objects in them
+ * would then point to the wrong place. This header provides a pointer type
+ * that stores where its target is relative to itself instead. As long as the
+ * pointer and its target are in the same pool, it's valid wherever the pool
+ * is mapped.
+ *
+ * @{
+ */
+
+#ifndef PMALLOC_OFFSET_PTR_HPP_
+#define PMALLOC_OFFSET_PTR_HPP_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace pmalloc {
+
+/** \brief A pointer to a `T`, stored as an offset from itself
+ *
+ * This behaves like `T *`. It can be copied anywhere, but it's only valid
+ * across mappings if it and its target are both in the same pool. Null is
+ * stored as an offset of one, since no object of a type that needs alignment
+ * can start one byte after a pointer to it.
+ */
+template <typename T>
+class offset_ptr {
+ public:
+    /** \brief The type pointed to */
+    typedef T element_type;
+
+    /** \brief Make a null pointer */
+    offset_ptr() noexcept : offset_(null_offset) {}
+    /** \brief Make a null pointer */
+    offset_ptr(std::nullptr_t) noexcept  // NOLINT(runtime/explicit)
+        : offset_(null_offset) {}
+    /** \brief Point to `ptr` */
+    offset_ptr(T *ptr) noexcept  // NOLINT(runtime/explicit)
+        : offset_(offset_to(ptr)) {}
+    /** \brief Point to the same thing as `other`
+     *
+     * The offset has to be recomputed, since this is somewhere else.
+     */
+    offset_ptr(const offset_ptr &other) noexcept
+        : offset_(offset_to(other.get())) {}
+
+    /** \brief Point to the same thing as `other` */
+    offset_ptr &operator=(const offset_ptr &other) noexcept {
+        offset_ = offset_to(other.get());
+        return *this;
+    }
+    /** \brief Point to `ptr` */
+    offset_ptr &operator=(T *ptr) noexcept {
+        offset_ = offset_to(ptr);
+        return *this;
+    }
+
+    /** \brief Get the address this points to in this mapping */
+    T *get() const noexcept {
+        if (offset_ == null_offset) {
+            return nullptr;
+        }
+        return reinterpret_cast<T *>(
+            reinterpret_cast<std::uintptr_t>(this) + offset_);
+    }
+
+    T &operator*() const noexcept { return *get(); }
+    T *operator->() const noexcept { return get(); }
+    T &operator[](std::ptrdiff_t i) const noexcept { return get()[i]; }
+    explicit operator bool() const noexcept { return offset_ != null_offset; }
+
+    friend bool operator==(const offset_ptr &a, const offset_ptr &b) noexcept {
+        return a.get() == b.get();
+    }
+    friend bool operator!=(const offset_ptr &a, const offset_ptr &b) noexcept {
+        return a.get() != b.get();
+    }
+
+ private:
+    /** \brief The offset that means this is null */
+    static constexpr std::uintptr_t null_offset = 1;
+
+    /** \brief Compute the offset from this to `ptr` */
+    std::uintptr_t offset_to(T *ptr) const noexcept {
+        if (ptr == nullptr) {
+            return null_offset;
+        }
+        // Unsigned arithmetic wraps, so this works whichever way `ptr` is
+        return reinterpret_cast<std::uintptr_t>(ptr)
+            - reinterpret_cast<std::uintptr_t>(this);
+    }
+
+    std::uintptr_t offset_;
+};
+
+}  // namespace pmalloc
+
+/**@}*/
+
+#endif  // PMALLOC_OFFSET_PTR_HPP_
@@ -17,10 +17,15 @@
 #ifndef PMALLOC_PMALLOC_H_
 #define PMALLOC_PMALLOC_H_
 
+#include <stdbool.h>
 #include <stddef.h>
 
 #include "pmalloc/config.h"
 
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
 #if (defined(PMALLOC_WIN32) && defined(PMALLOC_IS_SHARED)) || defined(DOXYGEN)
 #   if defined(PMALLOC_EXPORTS) || defined(DOXYGEN)
         /** \brief Marker for DLL functions on Windows */
@@ -49,6 +54,17 @@
 typedef struct pmalloc_pool_t pmalloc_pool_t;
 
 
+/** \brief Initialize the library
+ *
+ * This finds out what page sizes the OS supports, which might involve reading
+ * from the filesystem. It's called automatically when the library is loaded,
+ * and again before any pages are allocated, so calling it is never required.
+ * It can be called to control when the work happens. It's safe to call more
+ * than once, and from multiple threads.
+ */
+PMALLOC_API void pmalloc_init(void);
+
+
 /** \defgroup pool Pool Management
  *  \brief Functions for the creation, destruction, and protection of pools
  *
@@ -73,10 +89,12 @@ typedef struct pmalloc_pool_t pmalloc_pool_t;
  * reclaim this space. Thus, `page_size` should be chosen to minimize this
  * fragmentation.
  *
- * Additionally, when a pool is protected, all the pages in the pool are marked
- * as read only, and no new writable objects can be allocated there. The space
- * in those old pages is wasted. Again, `page_size` should be chosen to minimize
- * this effect.
+ * Additionally, when a pool is protected, the parts of its pages that hold
+ * objects are marked as read only. This happens at the granularity of OS pages.
+ * Any whole OS pages of free space stay writable, and new objects can still be
+ * allocated there. The rest of the space in a partially filled OS page is
+ * wasted. If `page_size` is a single OS page, the whole page is marked as read
+ * only, and all its free space is wasted.
  *
  * \param page_size Write permission granularity in bytes. Must be at least `1`
  * \return Opaque handle of the pool created, or `NULL` if `page_size` was `0`
@@ -94,6 +112,208 @@ static inline pmalloc_pool_t *pmalloc_create_pool(void) {
 }
 
 
+/** \brief Give each thread its own chunk of the pool to allocate from
+ *
+ * Normally, every thread bumps the boundary pointer of the same head page, so
+ * they all fight over the same cache line. With this flag, each thread carves
+ * out a chunk of the pool and allocates small objects from it without any
+ * synchronization. It only goes back to the shared pool when its chunk runs
+ * out. The chunks are part of the pool's pages, so they are still protected by
+ * pmalloc_protect_pool().
+ *
+ * The space left in a thread's chunk is wasted when the thread exits, when the
+ * pool is protected, or when the thread starts using another pool that maps to
+ * the same cache slot. This flag does nothing if the library isn't thread-safe.
+ *
+ * \sa PMALLOC_THREAD_CACHE_CHUNK
+ */
+#define PMALLOC_POOL_THREAD_CACHE (1u << 0)
+
+/** \brief Take all the pool's pages from one contiguous region
+ *
+ * Normally, each page of a pool is mapped separately, so the pages are
+ * scattered across the address space. With this flag, one large region of
+ * address space is reserved when the pool is created, and pages are committed
+ * from it in order. Protecting the pool then takes a single system call, as
+ * does destroying it. It also keeps the number of memory mappings the pool
+ * needs constant.
+ *
+ * The size of the region is given by pmalloc_pool_attr_t::arena_size. It only
+ * reserves address space, not memory. If it runs out, new pages are mapped
+ * separately.
+ */
+#define PMALLOC_POOL_ARENA (1u << 1)
+
+/** \brief Keep page metadata outside of the pages themselves
+ *
+ * Normally, each page starts with a small header describing it. This flag keeps
+ * those headers in a compact table owned by the pool instead, so pages hold
+ * only objects. Allocation then doesn't have to touch the page's first cache
+ * line to check whether an object fits, the headers aren't sealed along with
+ * the objects, and no space in the page is lost to them.
+ */
+#define PMALLOC_POOL_EXTERNAL_HEADERS (1u << 2)
+
+/** \brief Reuse the free space left in earlier pages
+ *
+ * Normally, objects are only allocated from the pool's newest page. When one
+ * doesn't fit, a new page is started, and the space left in the old one goes to
+ * waste. With this flag, the pool keeps a few of those pages around. An object
+ * that doesn't fit in the newest page goes in the open page with the least
+ * space that still fits it, and a new page is only started if none do. This
+ * wastes much less memory when objects of very different sizes are mixed.
+ *
+ * Open pages are still protected by pmalloc_protect_pool(). Allocating from
+ * them takes the pool's lock, so this is slower when objects don't fit in the
+ * newest page.
+ */
+#define PMALLOC_POOL_BEST_FIT (1u << 3)
+
+/** \brief Allow protected objects to be changed with pmalloc_rare_write()
+ *
+ * Data that's protected sometimes still needs to change, like configuration
+ * that's updated once in a while. Normally, pmalloc_rare_write() has to make
+ * the OS pages being written writable, copy, and make them read only again.
+ * With this flag, the pool's pages are backed by a memory file that's mapped
+ * twice. The pointers handed out are in a mapping that gets protected, and the
+ * other mapping stays writable. pmalloc_rare_write() then just copies through
+ * the second mapping, without any system calls. It's never handed out.
+ *
+ * This implies `PMALLOC_POOL_ARENA`, and only the pages in the arena get the
+ * second mapping. If `PMALLOC_MEMFD` is unset, this flag does nothing.
+ */
+#define PMALLOC_POOL_WRITE_RARE (1u << 4)
+
+#if defined(PMALLOC_MEMFD) || defined(DOXYGEN)
+/** \brief Let other processes map the pool read only
+ *
+ * Normally, a pool's pages are private to the process that made it. With this
+ * flag, they're backed by a memory file instead. Other processes can get the
+ * file's descriptor, say by inheriting it or over a UNIX socket, and attach to
+ * the pool with pmalloc_attach_pool(). They all share the same physical
+ * memory, so large read-only tables only have to be built once.
+ *
+ * Only the process that created the pool can allocate in it. All the pool's
+ * pages come from its arena, so allocations fail once the arena is full. This
+ * implies `PMALLOC_POOL_ARENA`. It's only available with `PMALLOC_MEMFD`.
+ *
+ * \sa pmalloc_pool_fd()
+ * \sa pmalloc_set_root()
+ */
+#define PMALLOC_POOL_SHARED (1u << 5)
+#endif
+
+/** \brief Map and fault in the next page before it's needed
+ *
+ * Normally, when the head page fills up, the thread that needs a new one maps
+ * it while holding the pool's lock, and then takes a page fault on each OS
+ * page as it's first written. With this flag, the pool keeps a spare page
+ * ready. It's mapped and faulted in by the allocation that fills the head page
+ * past halfway, outside the lock, while other threads keep allocating from the
+ * head. Moving to a new page then just links the spare one in.
+ *
+ * The spare page uses memory before it's needed. Only pmalloc_align() and
+ * pmalloc() refill it, not the functions that allocate many objects at once.
+ */
+#define PMALLOC_POOL_PREFAULT (1u << 6)
+
+/** \brief Release the free space that can't be used anymore on protection
+ *
+ * This calls pmalloc_trim_pool() every time the pool is protected, but only
+ * looks at the pages retired since the last protection. With
+ * `PMALLOC_POOL_BEST_FIT`, retiring an open page for one with more room makes
+ * the next protection look at every page instead.
+ */
+#define PMALLOC_POOL_TRIM (1u << 7)
+
+/** \brief Let the OS place a pool's pages
+ *
+ * Pages follow the policy of the thread that maps them, which is usually to put
+ * them on the NUMA node of the first thread to touch them. This is the default.
+ *
+ * \sa pmalloc_pool_attr_t::numa_policy
+ */
+#define PMALLOC_NUMA_DEFAULT 0u
+/** \brief Put a pool's pages on the node of the thread that first touches them
+ *
+ * This ignores any policy the thread was given with `set_mempolicy`.
+ */
+#define PMALLOC_NUMA_LOCAL 1u
+/** \brief Put a pool's pages on pmalloc_pool_attr_t::numa_node only */
+#define PMALLOC_NUMA_BIND 2u
+/** \brief Spread a pool's pages across all the nodes, one OS page at a time
+ *
+ * This is for pools that all threads read from equally. No thread gets local
+ * memory, but none of the nodes' memory bandwidth is a bottleneck either.
+ */
+#define PMALLOC_NUMA_INTERLEAVE 3u
+
+/** \brief Attributes used to create a pool
+ *
+ * Some features of a pool are optional, and must be chosen when the pool is
+ * created. This structure collects them. It should be initialized with
+ * pmalloc_pool_attr_init() before any fields are changed, so that new fields
+ * get sensible defaults.
+ *
+ * \sa pmalloc_create_attr_pool()
+ */
+typedef struct pmalloc_pool_attr_t {
+    /** \brief Write permission granularity in bytes
+     * \sa pmalloc_create_custom_pool()
+     */
+    size_t page_size;
+    /** \brief Bitwise OR of `PMALLOC_POOL_*` flags */
+    unsigned flags;
+    /** \brief Bytes of address space to reserve with `PMALLOC_POOL_ARENA`
+     * \sa PMALLOC_DEFAULT_ARENASIZE
+     */
+    size_t arena_size;
+    /** \brief Which NUMA nodes to put pages on, as a `PMALLOC_NUMA_*` value
+     *
+     * This does nothing if `PMALLOC_NUMA` is unset. Pages taken from the page
+     * cache are placed too, but their headers might already be on the wrong
+     * node.
+     */
+    unsigned numa_policy;
+    /** \brief The node to put pages on with `PMALLOC_NUMA_BIND`
+     *
+     * Nodes are numbered from zero, and must be less than
+     * #PMALLOC_NUMA_MAXNODES.
+     */
+    int numa_node;
+} pmalloc_pool_attr_t;
+
+/** \brief How many NUMA nodes `pmalloc` can place pages on */
+#define PMALLOC_NUMA_MAXNODES 64
+
+/** \brief Initialize pool attributes to their defaults
+ *
+ * The defaults give a pool identical to one from pmalloc_create_pool().
+ */
+static inline void pmalloc_pool_attr_init(pmalloc_pool_attr_t *attr) {
+    attr->page_size = PMALLOC_DEFAULT_PAGESIZE;
+    attr->flags = 0;
+    attr->arena_size = PMALLOC_DEFAULT_ARENASIZE;
+    attr->numa_policy = PMALLOC_NUMA_DEFAULT;
+    attr->numa_node = 0;
+}
+
+/** \brief Create a pool with the specified attributes
+ *
+ * This is like pmalloc_create_custom_pool(), but allows optional features to
+ * be turned on.
+ *
+ * \param [in] attr Attributes of the pool to create
+ * \return Opaque handle of the pool created, or `NULL` if the attributes were
+ *         invalid
+ *
+ * \sa pmalloc_pool_attr_init()
+ * \sa pmalloc_destroy_pool()
+ */
+PMALLOC_API pmalloc_pool_t *pmalloc_create_attr_pool(
+    const pmalloc_pool_attr_t *attr);
+
+
 /** \brief Destroy a pool given its handle
  *
  * A pool will leak resources if it isn't destroyed. Thus, this function takes
@@ -102,6 +322,9 @@ static inline pmalloc_pool_t *pmalloc_create_pool(void) {
  * in is no longer valid, nor are the objects that were present in the pool.
  * Using either of them is undefined behavior.
  *
+ * If `PMALLOC_PAGE_CACHE` is set, the pool's pages are returned to the page
+ * cache for later reuse instead of being unmapped.
+ *
  * \param [in] pool Handle of the pool to destroy
  */
 PMALLOC_API void pmalloc_destroy_pool(pmalloc_pool_t *pool);
@@ -109,16 +332,356 @@ PMALLOC_API void pmalloc_destroy_pool(pmalloc_pool_t *pool);
 /** \brief Mark a pool as read only given its handle
  *
  * A pool can be marked as read only. When that happens, writes are disabled to
- * all the pages in the pool, causing future writes to the pool's objects to
- * fault. More objects can be allocated in the pool, but they will be placed in
- * new pages, with extra space in the read only pages going to waste. For this
- * reason, during pool creation `page_size` should be chosen to minimize this
- * fragmentation.
+ * all the objects in the pool, causing future writes to them to fault. More
+ * objects can be allocated in the pool. They are placed in the free OS pages
+ * left in the pool's current page if there are any, and in new pages
+ * otherwise. Free space in OS pages that were marked as read only goes to
+ * waste. For this reason, during pool creation `page_size` should be chosen to
+ * minimize this fragmentation.
  *
  * \param [in] pool Handle of the pool to destroy
  */
 PMALLOC_API void pmalloc_protect_pool(pmalloc_pool_t *pool);
 
+/** \brief Give the memory of free space nothing can be allocated in back
+ *
+ * Only the pool's newest page is allocated from, along with its open pages
+ * with `PMALLOC_POOL_BEST_FIT`. The free space left in every other page can
+ * never be used, and neither can the free space in pages that protection made
+ * read only. It usually isn't touched, so it doesn't take any memory. But it
+ * does if the page was reused after pmalloc_reset_pool(), or prefaulted with
+ * `PMALLOC_POOL_PREFAULT`, or backed by a huge page that was split.
+ *
+ * This releases the whole OS pages in that free space. They stay mapped, so
+ * the pool's pages can still be protected and freed with one call each.
+ * Pages backed by a file, with `PMALLOC_POOL_WRITE_RARE` or
+ * `PMALLOC_POOL_SHARED`, are skipped, since their memory belongs to the file.
+ *
+ * \param [in] pool Handle of the pool to trim
+ * \return How many bytes were released
+ *
+ * \sa PMALLOC_POOL_TRIM
+ */
+PMALLOC_API size_t pmalloc_trim_pool(pmalloc_pool_t *pool);
+
+/** \brief Free every object in a pool, but keep its pages
+ *
+ * This is for pools that are filled and thrown away over and over, like one
+ * for each request a server handles. Rather than destroying the pool and
+ * creating a new one, it can be reset. All the objects in it are freed at once,
+ * and its pages are kept to allocate from again. Pages that were protected are
+ * made writable again. Objects too big for a normal page had their own pages,
+ * which are freed.
+ *
+ * Using objects that were in the pool is undefined behavior afterwards, as is
+ * calling this while other threads are allocating from the pool.
+ *
+ * \param [in] pool Handle of the pool to reset
+ */
+PMALLOC_API void pmalloc_reset_pool(pmalloc_pool_t *pool);
+
+/** \brief A point in a pool's allocations to go back to
+ *
+ * The fields are private. Get one with pmalloc_mark().
+ *
+ * \sa pmalloc_rewind()
+ */
+typedef struct pmalloc_mark_t {
+    void *page;  ///< The head page when the mark was taken
+    size_t offset;  ///< The head page's boundary pointer offset
+    void *large;  ///< The newest page for an object too big for a normal page
+    size_t generation;  ///< Used to check that the mark is still valid
+} pmalloc_mark_t;
+
+/** \brief Remember the current point in a pool's allocations
+ *
+ * \param [in] pool Handle of the pool to mark
+ * \return A mark to pass to pmalloc_rewind()
+ */
+PMALLOC_API pmalloc_mark_t pmalloc_mark(pmalloc_pool_t *pool);
+
+/** \brief Free every object allocated in a pool since it was marked
+ *
+ * This is like pmalloc_reset_pool(), but it only frees the objects allocated
+ * after `mark` was taken. Marks can be nested. Once the pool is rewound to a
+ * mark, using any mark taken after it is undefined behavior, as is calling this
+ * while other threads are allocating from the pool.
+ *
+ * Memory that was protected can't be given back this way, so marks taken
+ * before the pool was last protected or reset are rejected. With
+ * `PMALLOC_POOL_BEST_FIT`, objects that were put in pages older than the mark
+ * aren't freed.
+ *
+ * \param [in] pool Handle of the pool the mark was taken in
+ * \param mark A mark from pmalloc_mark()
+ * \return Whether the pool was rewound. It isn't if the pool was protected or
+ *         reset since `mark` was taken.
+ */
+PMALLOC_API bool pmalloc_rewind(pmalloc_pool_t *pool, pmalloc_mark_t mark);
+
+/** \brief Change an object in a pool, even if it's protected
+ *
+ * This copies `len` bytes from `src` to `dst` as if by `memcpy`, where `dst`
+ * is in a page of `pool`. The write can't span more than one page. If the
+ * destination is protected, it stays protected afterwards. This is much faster
+ * for pools with `PMALLOC_POOL_WRITE_RARE`, since the protection doesn't have
+ * to change.
+ *
+ * \param [in] pool Handle of the pool `dst` is in
+ * \param [out] dst Where to write in the pool
+ * \param [in] src What to write
+ * \param len Number of bytes to write
+ * \return Whether the write was done. It isn't if `dst` to `dst+len-1` isn't
+ *         in one of the pool's pages, or if the sealed pages couldn't be made
+ *         writable.
+ *
+ * \sa PMALLOC_POOL_WRITE_RARE
+ */
+PMALLOC_API bool pmalloc_rare_write(
+    pmalloc_pool_t *pool,
+    void *dst,
+    const void *src,
+    size_t len);
+
+#if defined(PMALLOC_MEMFD) || defined(DOXYGEN)
+/** \brief Get the file descriptor backing a pool
+ *
+ * Pass this to another process to let it attach to the pool. It stays owned by
+ * the pool, and it's closed when the pool is destroyed.
+ *
+ * \param [in] pool Handle of the pool
+ * \return The file descriptor, or `-1` if the pool isn't backed by a file it
+ *         owns
+ *
+ * \sa PMALLOC_POOL_SHARED
+ */
+PMALLOC_API int pmalloc_pool_fd(pmalloc_pool_t *pool);
+
+/** \brief Attach to a shared pool made by another process
+ *
+ * The pool is mapped read only, at the same address it has in the process that
+ * made it, so pointers into it are still valid. Pages the other process adds
+ * later are seen too. The returned handle can't allocate, and it has to be
+ * freed with pmalloc_destroy_pool(). Start from the object given by
+ * pmalloc_get_root().
+ *
+ * \param fd The file descriptor from pmalloc_pool_fd(). It isn't closed, and
+ *           it isn't needed after this returns.
+ * \return Handle of the pool attached to, or `NULL` if `fd` isn't a shared
+ *         pool, or if the pool's address is already in use in this process
+ */
+PMALLOC_API pmalloc_pool_t *pmalloc_attach_pool(int fd);
+
+/** \brief Create a shared pool whose pages are kept in a file
+ *
+ * This is like pmalloc_create_attr_pool() with `PMALLOC_POOL_SHARED`, except
+ * the pages are a mapping of the file at `path` instead of a memory file. It's
+ * created, or truncated if it exists. The file keeps the pool's contents after
+ * the pool is destroyed, so it can be opened again later with
+ * pmalloc_open_file_pool().
+ *
+ * A file can be mapped at a different address each time it's opened, so
+ * pointers stored in the pool won't be valid. Store offsets instead, like with
+ * `pmalloc::offset_ptr` from pmalloc/offset_ptr.hpp.
+ *
+ * \param [in] path Where to create the file
+ * \param [in] attr Attributes of the pool to create
+ * \return Handle of the pool created, or `NULL` if the file couldn't be
+ *         created or the attributes were invalid
+ *
+ * \sa pmalloc_flush_pool()
+ */
+PMALLOC_API pmalloc_pool_t *pmalloc_create_file_pool(
+    const char *path,
+    const pmalloc_pool_attr_t *attr);
+
+/** \brief Open a file made with pmalloc_create_file_pool()
+ *
+ * The file is mapped read only, wherever there's room. Nothing is copied, so
+ * this is fast even for large pools. The returned handle can't allocate, and it
+ * has to be freed with pmalloc_destroy_pool(). Start from the object given by
+ * pmalloc_get_root().
+ *
+ * \param [in] path The file to open
+ * \return Handle of the pool opened, or `NULL` if the file couldn't be opened
+ *         or isn't a pool
+ */
+PMALLOC_API pmalloc_pool_t *pmalloc_open_file_pool(const char *path);
+
+/** \brief Write a file-backed pool's pages to its file
+ *
+ * This waits until all the data allocated so far is in the file. The OS writes
+ * it eventually even without this, as long as the machine doesn't crash.
+ *
+ * \param [in] pool Handle of a pool from pmalloc_create_file_pool()
+ */
+PMALLOC_API void pmalloc_flush_pool(pmalloc_pool_t *pool);
+
+/** \brief Set the object other processes should start from
+ *
+ * Processes attaching to a shared pool don't know where anything in it is. The
+ * process that made the pool sets this to point them to the first object.
+ *
+ * \param [in] pool Handle of a pool created with `PMALLOC_POOL_SHARED`
+ * \param [in] root An object in the pool, or `NULL`
+ */
+PMALLOC_API void pmalloc_set_root(pmalloc_pool_t *pool, void *root);
+
+/** \brief Get the object set with pmalloc_set_root()
+ *
+ * \param [in] pool Handle of a shared pool, made, attached to, or opened
+ * \return The object, or `NULL` if none was set
+ */
+PMALLOC_API void *pmalloc_get_root(pmalloc_pool_t *pool);
+#endif
+
+/** \brief Opaque handle to a set of copies of a pool, one per NUMA node
+ *
+ * The implementation details of this structure can be found in
+ * pmalloc/internals.h.
+ *
+ * \sa pmalloc_create_replicas()
+ */
+typedef struct pmalloc_replicas_t pmalloc_replicas_t;
+
+/** \brief Build a copy of some read-mostly data on each NUMA node
+ *
+ * Lookups in protected data that's read from every node often cross the
+ * interconnect, since the data can only be on one of them. This makes a pool
+ * for each node, with its pages bound to that node, and calls `build` to fill
+ * it. Each pool is then protected. Threads find the copy on their own node
+ * with pmalloc_local_replica().
+ *
+ * The data is built again for each node rather than copied, so pointers in it
+ * are valid. `build` is called from the calling thread, and has to allocate
+ * everything in the pool it's given. It returns the object to start from. On
+ * machines with one node, or if `PMALLOC_NUMA` is unset, there's just one
+ * copy.
+ *
+ * \param [in] attr Attributes of the pools. The NUMA policy is ignored.
+ * \param build Function to fill each pool. It's passed the pool and `arg`.
+ * \param [in] arg Passed to `build`
+ * \return Handle of the copies, or `NULL` if the attributes were invalid or
+ *         `build` returned `NULL`
+ *
+ * \sa pmalloc_destroy_replicas()
+ */
+PMALLOC_API pmalloc_replicas_t *pmalloc_create_replicas(
+    const pmalloc_pool_attr_t *attr,
+    void *(*build)(pmalloc_pool_t *pool, void *arg),
+    void *arg);
+
+/** \brief Get the copy for the NUMA node the calling thread is running on
+ *
+ * Threads can move between nodes, so this should be called again for each
+ * lookup rather than cached. It usually doesn't make any system calls.
+ *
+ * \param [in] replicas Handle from pmalloc_create_replicas()
+ * \return What `build` returned for the local node's pool. If that node
+ *         doesn't have one, the copy for some other node.
+ */
+PMALLOC_API void *pmalloc_local_replica(const pmalloc_replicas_t *replicas);
+
+/** \brief Destroy the pools made by pmalloc_create_replicas()
+ *
+ * \param [in] replicas Handle of the copies to destroy
+ */
+PMALLOC_API void pmalloc_destroy_replicas(pmalloc_replicas_t *replicas);
+
+/** \brief Opaque handle to a set of pools that are protected together
+ *
+ * The implementation details of this structure can be found in
+ * pmalloc/internals.h.
+ *
+ * \sa pmalloc_create_group()
+ */
+typedef struct pmalloc_group_t pmalloc_group_t;
+
+/** \brief Make a group of pools that share one arena
+ *
+ * Programs often keep several pools that are always protected at the same
+ * time, like one for each kind of object in a table that's built and then
+ * frozen. Protecting each pool separately takes at least one system call per
+ * pool, and their pages are scattered, so the kernel ends up splitting its
+ * mappings. Pools created in a group instead take their pages from one region
+ * of address space, in the order they need them. pmalloc_protect_group() then
+ * seals all of them, coalescing pages that are next to each other no matter
+ * which pool they're from.
+ *
+ * Sealing only covers the allocated part of each page, so pages are only
+ * coalesced with their neighbours when they're full, or when the page size is
+ * one OS page. Once the region is full, members map their pages separately.
+ *
+ * \param arena_size Bytes of address space to reserve for the group's pages,
+ *                   or `0` for #PMALLOC_DEFAULT_ARENASIZE
+ * \return Handle of the group, which has no pools yet
+ *
+ * \sa pmalloc_create_group_pool()
+ * \sa pmalloc_destroy_group()
+ */
+PMALLOC_API pmalloc_group_t *pmalloc_create_group(size_t arena_size);
+
+/** \brief Create a pool whose pages come from a group
+ *
+ * The pool behaves exactly like one from pmalloc_create_attr_pool(), and can
+ * still be protected on its own. Its pages are taken from the group's region
+ * rather than its own arena, so `PMALLOC_POOL_ARENA` and the arena size are
+ * ignored. Pools that need their own file, with `PMALLOC_POOL_WRITE_RARE` or
+ * `PMALLOC_POOL_SHARED`, can't be in a group.
+ *
+ * The pool can be destroyed with pmalloc_destroy_pool() before the group is.
+ * Its pages in the group's region aren't freed until the group is, though.
+ *
+ * \param [in] group Handle of the group to add the pool to
+ * \param [in] attr Attributes of the pool to create
+ * \return Opaque handle of the pool created, or `NULL` if the attributes were
+ *         invalid
+ */
+PMALLOC_API pmalloc_pool_t *pmalloc_create_group_pool(
+    pmalloc_group_t *group,
+    const pmalloc_pool_attr_t *attr);
+
+/** \brief Mark every pool in a group as read only
+ *
+ * This is pmalloc_protect_pool() on each pool in the group, except that the
+ * ranges to seal are collected from all of them first. They're sorted and
+ * merged, so each run of adjacent ranges takes a single system call. Those
+ * calls are counted in the process-wide statistics, but not in any pool's.
+ *
+ * All the pools' locks are held at once while this runs.
+ *
+ * \param [in] group Handle of the group to protect
+ */
+PMALLOC_API void pmalloc_protect_group(pmalloc_group_t *group);
+
+/** \brief Destroy a group, and every pool still in it
+ *
+ * \param [in] group Handle of the group to destroy
+ */
+PMALLOC_API void pmalloc_destroy_group(pmalloc_group_t *group);
+
+#if defined(PMALLOC_PAGE_CACHE) || defined(DOXYGEN)
+/** \brief Set the maximum number of bytes kept in the page cache
+ *
+ * When pages are freed, like when a pool is destroyed, they aren't unmapped
+ * right away. Instead, they are made writable again, their memory is released
+ * to the OS, and they are kept in a process-wide cache. New pages are taken
+ * from the cache when possible, saving a system call to map them. Pages are
+ * grouped by size and by whether they are huge pages.
+ *
+ * Cached pages don't count towards the process's RSS, but they do take up
+ * virtual address space. This function bounds how much. If the cache holds
+ * more than the new limit, pages are unmapped until it doesn't. Setting the
+ * limit to zero empties the cache and disables it.
+ *
+ * \param limit Maximum number of bytes of pages to keep cached
+ * \return The previous limit
+ *
+ * \sa PMALLOC_PAGE_CACHE_MAXBYTES
+ */
+PMALLOC_API size_t pmalloc_set_page_cache_limit(size_t limit);
+#endif
+
 /**@}*/
 
 
@@ -148,16 +711,197 @@ PMALLOC_API void *pmalloc_align(
     size_t size,
     size_t align);
 
+#if !defined(__cplusplus) || defined(DOXYGEN)
 /** \brief Calls pmalloc_align() with the supplied arguments and the default
  *         alignment
+ *
+ * This isn't available in C++, where `pmalloc` is the namespace of the C++
+ * headers. Call pmalloc_align() with `PMALLOC_DEFAULT_ALIGNMENT` instead.
+ *
  * \sa pmalloc_align()
  */
 static inline void *pmalloc(pmalloc_pool_t *pool, size_t size) {
     return pmalloc_align(pool, size, PMALLOC_DEFAULT_ALIGNMENT);
 }
+#endif
+
+/** \brief Allocate many objects in a pool at once
+ *
+ * This behaves like calling pmalloc_align() on each of the objects in order,
+ * but it only checks its arguments and locks the pool once. Objects are packed
+ * into pages in the same way. It's meant for building large structures where
+ * the overhead of each individual call adds up.
+ *
+ * These allocations don't use the calling thread's cache, even if the pool has
+ * `PMALLOC_POOL_THREAD_CACHE`.
+ *
+ * \param [in] pool Handle of the pool to allocate memory in
+ * \param [in] sizes Number of bytes to allocate for each object
+ * \param [in] aligns The log-base-2 of the alignment needed for each object
+ * \param [out] out_ptrs Where to write the pointer to each object
+ * \param n Number of objects to allocate
+ * \return The number of objects allocated. This is `n` unless an object was
+ *         too big to allocate, in which case no objects after it are allocated.
+ *
+ * \sa pmalloc_array_n()
+ */
+PMALLOC_API size_t pmalloc_align_many(
+    pmalloc_pool_t *pool,
+    const size_t sizes[],
+    const size_t aligns[],
+    void *out_ptrs[],
+    size_t n);
+
+/** \brief Allocate many objects of the same size in a pool at once
+ *
+ * This is pmalloc_align_many() where all the objects have the same size and
+ * alignment. It claims as many objects as fit in a page at a time, so it's
+ * faster still.
+ *
+ * \param [in] pool Handle of the pool to allocate memory in
+ * \param size Number of bytes to allocate for each object
+ * \param align The log-base-2 of the alignment needed for each object
+ * \param n Number of objects to allocate
+ * \param [out] out Where to write the pointer to each object
+ * \return The number of objects allocated, which is `n` on success
+ */
+PMALLOC_API size_t pmalloc_array_n(
+    pmalloc_pool_t *pool,
+    size_t size,
+    size_t align,
+    size_t n,
+    void *out[]);
+
+/**@}*/
+
+
+/** \defgroup stats Statistics
+ *  \brief Functions to see how pools use memory
+ *
+ * Counters are kept for each pool and for the whole process. They're updated
+ * with relaxed atomic operations, so they're cheap, but a snapshot taken while
+ * other threads are allocating might not be consistent with itself. If
+ * `PMALLOC_STATS` is unset, the counters don't exist and all of them read as
+ * zero.
+ *
+ * @{
+ */
+
+/** \brief Statistics about a single pool
+ *
+ * All the "waste" counters are bytes in the pool's pages that will never hold
+ * an object. Along with the bytes allocated, the bytes still free, and the page
+ * headers, they add up to the bytes in the pool's pages.
+ *
+ * \sa pmalloc_pool_stats()
+ */
+typedef struct pmalloc_stats_t {
+    size_t pages;  ///< How many pages the pool has
+    size_t page_bytes;  ///< Total size of the pool's pages
+    /** \brief How many allocations were made
+     *
+     * With `PMALLOC_POOL_THREAD_CACHE`, each chunk a thread takes from the
+     * pool counts as one allocation of the whole chunk. The objects allocated
+     * within it aren't counted.
+     */
+    size_t allocations;
+    size_t allocated_bytes;  ///< Total size of the allocations made
+    size_t waste_alignment;  ///< Padding inserted to align objects
+    /** \brief Free space left behind in a page when a new one was started */
+    size_t waste_page_tail;
+    /** \brief Free space sealed by pmalloc_protect_pool()
+     *
+     * Protection works on whole OS pages, so free space sharing an OS page
+     * with allocated objects becomes read only.
+     */
+    size_t waste_protect;
+    size_t protects;  ///< How many times the pool was protected
+    /** \brief How many times pages were mapped or committed for the pool
+     *
+     * Each takes at most one system call. Pages reused from the page cache
+     * don't take any.
+     */
+    size_t map_calls;
+    size_t protect_calls;  ///< System calls made to protect pages
+    /** \brief Free space released by pmalloc_trim_pool() */
+    size_t trimmed_bytes;
+} pmalloc_stats_t;
+
+/** \brief Statistics about the whole process
+ * \sa pmalloc_global_stats()
+ */
+typedef struct pmalloc_global_stats_t {
+    size_t pools;  ///< How many pools exist
+    size_t pages;  ///< How many pages all the pools have
+    size_t page_bytes;  ///< Total size of all the pools' pages
+    size_t map_calls;  ///< System calls made to map or commit memory
+    size_t unmap_calls;  ///< System calls made to unmap memory
+    size_t protect_calls;  ///< System calls made to change protection
+    size_t advise_calls;  ///< System calls made to advise the kernel
+    size_t page_cache_hits;  ///< Pages reused from the page cache
+    size_t page_cache_bytes;  ///< Bytes of pages in the page cache
+} pmalloc_global_stats_t;
+
+/** \brief Get the statistics of a pool
+ *
+ * \param [in] pool Handle of the pool to look at
+ * \param [out] stats Where to write the statistics
+ */
+PMALLOC_API void pmalloc_pool_stats(
+    pmalloc_pool_t *pool,
+    pmalloc_stats_t *stats);
+
+/** \brief Get the statistics of the whole process
+ * \param [out] stats Where to write the statistics
+ */
+PMALLOC_API void pmalloc_global_stats(pmalloc_global_stats_t *stats);
 
 /**@}*/
 
+
+#if defined(PMALLOC_PAGE_MAP) || defined(DOXYGEN)
+/** \defgroup lookup Pointer Lookup
+ *  \brief Functions to find out where a pointer came from
+ *
+ * These are for hardening checks, like making sure data that should have been
+ * sealed really is before trusting it. They look pointers up in a map of every
+ * page in the process, so they take the same time no matter how many pools or
+ * pages there are, and they never take a lock. They need `PMALLOC_PAGE_MAP`.
+ *
+ * Looking up a pointer while its page is being freed, say because its pool is
+ * being destroyed or reset, is undefined behavior. Pools attached from another
+ * process have no pages of their own, so pointers into them aren't found.
+ *
+ * @{
+ */
+
+/** \brief Find the pool that a pointer was allocated from
+ *
+ * \param [in] ptr Any pointer. It doesn't have to point to the start of an
+ *                 object.
+ * \return Handle of the pool whose pages hold `ptr`, or `NULL` if it isn't in
+ *         any pool's pages
+ */
+PMALLOC_API pmalloc_pool_t *pmalloc_owner(const void *ptr);
+
+/** \brief Whether a pointer is in a pool, and has been made read only
+ *
+ * This is about what the pool sealed, not about the OS's current protection.
+ * Pages opened with pmalloc_rare_write() still count as protected.
+ *
+ * \param [in] ptr Any pointer
+ * \return Whether `ptr` is in a pool's pages, and was sealed by
+ *         pmalloc_protect_pool()
+ */
+PMALLOC_API bool pmalloc_is_protected(const void *ptr);
+
+/**@}*/
+#endif
+
+#if defined(__cplusplus)
+}  // extern "C"
+#endif
+
 /**@}*/
 
 #endif  // PMALLOC_PMALLOC_H_
@@ -0,0 +1,269 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2022  Ammar Ratnani <ammrat13@gmail.com>
+/** \file
+ *  \ingroup public
+ *  \brief C++ interface for `pmalloc`
+ *
+ * The C interface works from C++, but using it means repeating the same glue
+ * everywhere. Pools have to be destroyed by hand, alignments have to be given
+ * as a log-base-2, and objects have to be constructed with placement `new`.
+ * This header wraps all that. It's header-only, and it needs C++11.
+ *
+ * Objects in a pool are never destroyed individually. Their destructors don't
+ * run when the pool is destroyed either, so they should own nothing outside the
+ * pool.
+ *
+ * @{
+ */
+
+#ifndef PMALLOC_PMALLOC_HPP_
+#define PMALLOC_PMALLOC_HPP_
+
+#include <cstddef>
+#include <limits>
+#include <new>
+#include <utility>
+
+#include "pmalloc/pmalloc.h"
+
+namespace pmalloc {
+
+namespace detail {
+
+/** \brief The log-base-2 of `n`, rounded down
+ *
+ * This is in the form C++11 allows for `constexpr` functions.
+ */
+constexpr std::size_t log2(std::size_t n) noexcept {
+    return n <= 1 ? 0 : 1 + log2(n / 2);
+}
+
+/** \brief The alignment argument to pmalloc_align() for a `T`
+ *
+ * It's a constant, so it's computed when compiling.
+ */
+template <typename T>
+struct align_of {
+    static_assert(
+        (alignof(T) & (alignof(T) - 1)) == 0,
+        "alignments are powers of two");
+    static constexpr std::size_t value = log2(alignof(T));
+};
+
+/** \brief Allocate space for `n` objects of type `T` in `pool`
+ * \return The space, or `nullptr` if `n` is zero
+ * \throw std::bad_alloc If the space couldn't be allocated
+ */
+template <typename T>
+T *allocate(pmalloc_pool_t *pool, std::size_t n) {
+    if (n == 0) {
+        return nullptr;
+    }
+    if (n > std::numeric_limits<std::size_t>::max() / sizeof(T)) {
+        throw std::bad_alloc();
+    }
+    void *const ret = pmalloc_align(pool, n * sizeof(T), align_of<T>::value);
+    if (ret == nullptr) {
+        throw std::bad_alloc();
+    }
+    return static_cast<T *>(ret);
+}
+
+}  // namespace detail
+
+
+/** \brief A read-only view of an object in a protected pool
+ *
+ * It's returned by pool::seal(), and behaves like `const T *`. It doesn't own
+ * anything, so it's only valid as long as the pool is.
+ */
+template <typename T>
+class sealed {
+ public:
+    /** \brief The type pointed to */
+    typedef const T element_type;
+
+    /** \brief View `ptr`, which should be in a protected pool */
+    explicit sealed(const T *ptr) noexcept : ptr_(ptr) {}
+
+    /** \brief Get the object */
+    const T *get() const noexcept { return ptr_; }
+
+    const T &operator*() const noexcept { return *ptr_; }
+    const T *operator->() const noexcept { return ptr_; }
+    explicit operator bool() const noexcept { return ptr_ != nullptr; }
+
+ private:
+    const T *ptr_;
+};
+
+
+/** \brief Owner of a pool
+ *
+ * The pool is destroyed along with this. It can be moved, but not copied.
+ */
+class pool {
+ public:
+    /** \brief Create a pool with the default attributes
+     * \throw std::bad_alloc If the pool couldn't be created
+     * \sa pmalloc_create_pool()
+     */
+    pool() : pool_(check(pmalloc_create_pool())) {}
+    /** \brief Create a pool with `attr`
+     * \throw std::bad_alloc If the attributes were invalid
+     * \sa pmalloc_create_attr_pool()
+     */
+    explicit pool(const pmalloc_pool_attr_t &attr)
+        : pool_(check(pmalloc_create_attr_pool(&attr))) {}
+    /** \brief Take ownership of a pool from the C interface */
+    explicit pool(pmalloc_pool_t *handle) noexcept : pool_(handle) {}
+
+    /** \brief Take the pool from `other`, leaving it empty */
+    pool(pool &&other) noexcept : pool_(other.release()) {}
+    /** \brief Destroy this pool, and take the pool from `other` */
+    pool &operator=(pool &&other) noexcept {
+        if (this != &other) {
+            reset(other.release());
+        }
+        return *this;
+    }
+    pool(const pool &) = delete;
+    pool &operator=(const pool &) = delete;
+
+    ~pool() { reset(); }
+
+    /** \brief Get the handle for the C interface */
+    pmalloc_pool_t *get() const noexcept { return pool_; }
+    /** \brief Give up ownership of the pool without destroying it */
+    pmalloc_pool_t *release() noexcept {
+        pmalloc_pool_t *const ret = pool_;
+        pool_ = nullptr;
+        return ret;
+    }
+    /** \brief Destroy the pool, and own `handle` instead */
+    void reset(pmalloc_pool_t *handle = nullptr) noexcept {
+        if (pool_ != nullptr) {
+            pmalloc_destroy_pool(pool_);
+        }
+        pool_ = handle;
+    }
+    explicit operator bool() const noexcept { return pool_ != nullptr; }
+
+    /** \brief Construct a `T` in the pool from `args`
+     *
+     * It's aligned for a `T`. Its destructor is never called.
+     *
+     * \throw std::bad_alloc If the space couldn't be allocated
+     */
+    template <typename T, typename... Args>
+    T *make(Args &&...args) {
+        return new (detail::allocate<T>(pool_, 1))
+            T(std::forward<Args>(args)...);
+    }
+
+    /** \brief Allocate uninitialized space for `n` objects of type `T`
+     * \throw std::bad_alloc If the space couldn't be allocated
+     */
+    template <typename T>
+    T *allocate(std::size_t n = 1) {
+        return detail::allocate<T>(pool_, n);
+    }
+
+    /** \brief Mark everything in the pool as read only
+     * \sa pmalloc_protect_pool()
+     */
+    void protect() noexcept { pmalloc_protect_pool(pool_); }
+
+    /** \brief Protect the pool, and get a read-only view of `root`
+     *
+     * This is for building a structure in the pool, then handing it out so
+     * that it can't be changed. `root` should be in the pool.
+     */
+    template <typename T>
+    sealed<T> seal(const T *root) noexcept {
+        protect();
+        return sealed<T>(root);
+    }
+
+    /** \brief Release free space that can't be allocated from anymore
+     * \return How many bytes were released
+     * \sa pmalloc_trim_pool()
+     */
+    std::size_t trim() noexcept { return pmalloc_trim_pool(pool_); }
+
+    /** \brief Free everything in the pool, but keep its pages
+     * \sa pmalloc_reset_pool()
+     */
+    void clear() noexcept { pmalloc_reset_pool(pool_); }
+
+ private:
+    /** \brief Throw if a pool couldn't be created */
+    static pmalloc_pool_t *check(pmalloc_pool_t *handle) {
+        if (handle == nullptr) {
+            throw std::bad_alloc();
+        }
+        return handle;
+    }
+
+    pmalloc_pool_t *pool_;
+};
+
+
+/** \brief An allocator for standard containers that allocates from a pool
+ *
+ * Deallocation does nothing, since objects in a pool can't be freed one at a
+ * time. Memory is reclaimed when the pool is reset or destroyed, so containers
+ * using this must not outlive their pool. Containers that grow, like
+ * `std::vector`, leave their old storage behind in the pool. Reserve space up
+ * front to avoid that.
+ *
+ * Allocators compare equal if they allocate from the same pool.
+ */
+template <typename T>
+class allocator {
+ public:
+    typedef T value_type;
+    typedef std::size_t size_type;
+    typedef std::ptrdiff_t difference_type;
+
+    /** \brief Allocate from `p` */
+    allocator(pool &p) noexcept  // NOLINT(runtime/explicit)
+        : pool_(p.get()) {}
+    /** \brief Allocate from a pool from the C interface */
+    explicit allocator(pmalloc_pool_t *handle) noexcept : pool_(handle) {}
+    /** \brief Allocate from the same pool as `other`
+     *
+     * Node-based containers need this to allocate their nodes.
+     */
+    template <typename U>
+    allocator(const allocator<U> &other) noexcept  // NOLINT(runtime/explicit)
+        : pool_(other.get()) {}
+
+    /** \brief Get the pool this allocates from */
+    pmalloc_pool_t *get() const noexcept { return pool_; }
+
+    /** \brief Allocate space for `n` objects
+     * \throw std::bad_alloc If the space couldn't be allocated
+     */
+    T *allocate(std::size_t n) { return detail::allocate<T>(pool_, n); }
+    /** \brief Do nothing, since objects are freed with the pool */
+    void deallocate(T *, std::size_t) noexcept {}
+
+ private:
+    pmalloc_pool_t *pool_;
+};
+
+template <typename T, typename U>
+bool operator==(const allocator<T> &a, const allocator<U> &b) noexcept {
+    return a.get() == b.get();
+}
+template <typename T, typename U>
+bool operator!=(const allocator<T> &a, const allocator<U> &b) noexcept {
+    return a.get() != b.get();
+}
+
+}  // namespace pmalloc
+
+/**@}*/
+
+#endif  // PMALLOC_PMALLOC_HPP_
@@ -1,17 +1,49 @@
 // SPDX-License-Identifier: GPL-2.0
 // Copyright (C) 2022  Ammar Ratnani <ammrat13@gmail.com>
 
+// Needed for `memfd_create`. It has to come before any system header.
+#define _GNU_SOURCE
+
 #include <assert.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <sys/mman.h>
 
 #include "pmalloc/internals.h"
 
-#if defined(PMALLOC_ROUND_PAGESIZE) && defined(PMALLOC_HUGETLB)
+#if defined(PMALLOC_MEMFD)
+#   include <fcntl.h>
+#   include <sys/stat.h>
+#endif
+
+// Older headers might not have this. It's part of the kernel's ABI, so it won't
+// change. Kernels that don't support it treat the address as a hint.
+#if defined(PMALLOC_MEMFD) && !defined(MAP_FIXED_NOREPLACE)
+#   define MAP_FIXED_NOREPLACE 0x100000
+#endif
+
+#if defined(PMALLOC_NUMA)
+#   include <limits.h>
+#   include <sched.h>
+#   include <sys/syscall.h>
+#   include <linux/mempolicy.h>
+#endif
+
+// Older headers might not have this. Kernels before 3.8 don't support it, and
+// they return an error, which we ignore.
+#if defined(PMALLOC_NUMA) && !defined(MPOL_LOCAL)
+#   define MPOL_LOCAL 4
+#endif
+
+#if defined(PMALLOC_HUGETLB)
 #   include <stdio.h>
-#   include <string.h>
 #   include <errno.h>
+#   include <dirent.h>
+#endif
+#if defined(PMALLOC_PAGE_CACHE) || defined(PMALLOC_THP) \
+    || defined(PMALLOC_HUGETLB)
+#   include <stdint.h>
 #endif
 
 // This file should only be compiled on Linux.
@@ -26,6 +58,17 @@
 #   define FOR_ASSERT(x)
 #endif
 
+// Older headers might not have this, but we can still try it. Kernels that
+// don't support it will return an error, which we ignore.
+#if defined(PMALLOC_THP_COLLAPSE) && !defined(MADV_COLLAPSE)
+#   define MADV_COLLAPSE 25
+#endif
+// Same for this. Kernels before 5.14 don't support it, and then we touch the
+// pages ourselves.
+#if !defined(MADV_POPULATE_WRITE)
+#   define MADV_POPULATE_WRITE 23
+#endif
+
 
 void *pmalloc_alloc_pool(void) {
     void *ret = malloc(sizeof(pmalloc_pool_t));
@@ -38,98 +81,657 @@ void pmalloc_free_pool(void *ptr) {
     free(ptr);
 }
 
+void *pmalloc_alloc_heap(size_t size) {
+    assert(size > 0);
+    void *ret = malloc(size);
+    assert(ret);
+    return ret;
+}
+
+void pmalloc_free_heap(void *ptr) {
+    assert(ptr);
+    free(ptr);
+}
+
+
+// The size of normal pages, or zero if pmalloc_init() hasn't run yet
+#if defined(PMALLOC_ROUND_PAGESIZE)
+    static size_t os_page_size = 0;
+#endif
+
+#if defined(PMALLOC_PKEYS)
+    // The protection key sealed pages are tagged with, or -1 if the CPU or the
+    // kernel doesn't support them. Threads have writes to it disabled, except
+    // inside pmalloc_write_begin() and pmalloc_write_end().
+    static int pmalloc_pkey = -1;
+#endif
+
+/** \brief Make pages read only or writable with one system call
+ *
+ * With protection keys, sealed pages are still mapped writable. They're tagged
+ * with #pmalloc_pkey instead, which threads can't write to.
+ *
+ * \return The return value of the system call
+ */
+static int pmalloc_mprotect(void *ptr, size_t size, bool writable) {
+    PMALLOC_STAT_ADD(pmalloc_global_counters.protect_calls, 1);
+    #if defined(PMALLOC_PKEYS)
+        if (pmalloc_pkey != -1) {
+            return pkey_mprotect(
+                ptr, size, PROT_READ | PROT_WRITE, writable ? 0 : pmalloc_pkey);
+        }
+    #endif
+    return mprotect(ptr, size, writable ? PROT_READ | PROT_WRITE : PROT_READ);
+}
+
+#if defined(PMALLOC_NUMA)
+
+/** \brief A word of a node mask, as the kernel takes it
+ *
+ * The system calls are defined in terms of `unsigned long`, so its size can't
+ * be fixed.
+ */
+typedef unsigned long pmalloc_numa_word_t;  // NOLINT(runtime/int)
+
+/** \brief How many words the kernel needs for a node mask */
+#define PMALLOC_NUMA_WORDS \
+    (PMALLOC_NUMA_MAXNODES / (CHAR_BIT * sizeof(pmalloc_numa_word_t)))
+
+// The nodes this process can put memory on. It's found by pmalloc_init().
+static uint64_t pmalloc_numa_allowed = 1;
+// Whether any pages have been placed. If so, freed pages have to be reset
+// before they're cached, since they might be reused by a pool that wasn't.
+static bool pmalloc_numa_used = false;
+
+/** \brief Set the NUMA policy of pages, ignoring errors
+ *
+ * The system call is made directly, so libnuma isn't needed.
+ *
+ * \param mode One of the kernel's `MPOL_*` modes
+ * \param mask The nodes to use, if the mode takes any
+ */
+static void pmalloc_mbind(
+    void *ptr,
+    size_t size,
+    int mode,
+    uint64_t mask
+) {
+    pmalloc_numa_word_t words[PMALLOC_NUMA_WORDS];
+    for (size_t i = 0; i < PMALLOC_NUMA_WORDS; i++) {
+        words[i] = (pmalloc_numa_word_t)
+            (mask >> (i * CHAR_BIT * sizeof(pmalloc_numa_word_t)));
+    }
+    // The kernel reads one less bit than it's told to
+    const bool has_mask = mode != MPOL_DEFAULT && mode != MPOL_LOCAL;
+    syscall(
+        SYS_mbind, ptr, size, mode,
+        has_mask ? words : NULL, has_mask ? PMALLOC_NUMA_MAXNODES + 1 : 0,
+        0);
+}
+
+/** \brief Find out which nodes this process can put memory on */
+static void pmalloc_probe_numa_nodes(void) {
+    pmalloc_numa_word_t words[PMALLOC_NUMA_WORDS] = {0};
+    if (syscall(
+            SYS_get_mempolicy, NULL, words, PMALLOC_NUMA_MAXNODES, NULL,
+            MPOL_F_MEMS_ALLOWED) != 0) {
+        return;
+    }
+    uint64_t mask = 0;
+    for (size_t i = 0; i < PMALLOC_NUMA_WORDS; i++) {
+        mask |= (uint64_t) words[i]
+            << (i * CHAR_BIT * sizeof(pmalloc_numa_word_t));
+    }
+    if (mask != 0) {
+        pmalloc_numa_allowed = mask;
+    }
+}
+
+#endif
+
+#if defined(PMALLOC_HUGETLB)
+
+// Older headers might not have these. They're part of the kernel's ABI, so
+// they won't change.
+#   if !defined(MAP_HUGE_SHIFT)
+#       define MAP_HUGE_SHIFT 26
+#   endif
+
+/** \brief The most huge page sizes we keep track of
+ *
+ * x86-64 has two, and most other architectures have at most a handful.
+ */
+#define PMALLOC_HUGETLB_MAXSIZES 8
+
+/** \brief What we know about one size of huge page */
+typedef struct pmalloc_huge_size_t {
+    size_t size;  ///< The size of the huge page in bytes
+    /** \brief Roughly how many huge pages of this size are free
+     *
+     * This is read from sysfs when the library is initialized, then decreased
+     * as we map pages. Other processes can take pages too, so it's only a hint
+     * for when not to bother trying.
+     */
+    size_t free;
+    bool overcommit;  ///< Whether the kernel can make more pages on demand
+} pmalloc_huge_size_t;
+
+// The huge page sizes, from smallest to largest. These are only written by
+// pmalloc_init(), except for the free counts, which are accessed atomically.
+static pmalloc_huge_size_t os_huge_sizes[PMALLOC_HUGETLB_MAXSIZES];
+static size_t os_huge_sizes_count = 0;
+
+#endif
+
+
+#if defined(PMALLOC_THP)
+
+/** \brief Map memory aligned to a transparent huge page
+ *
+ * The kernel can only back memory with a huge page if the huge page would be
+ * entirely within the mapping, and if the mapping is aligned to it. So, we map
+ * one huge page more than we need, then unmap the slack at either end. The
+ * kernel is then advised to use huge pages for the mapping. If that fails, say
+ * because the kernel was built without transparent huge page support, the
+ * mapping is still usable with normal pages.
+ *
+ * \param size How many bytes to map. Must be a multiple of #PMALLOC_THP_SIZE.
+ * \param prot The protection to pass to `mmap`
+ * \param flags The flags to pass to `mmap`
+ * \return The mapping, or `MAP_FAILED` on failure
+ */
+static void *pmalloc_map_thp(size_t size, int prot, int flags) {
+    assert(size % PMALLOC_THP_SIZE == 0);
+    char *const map = mmap(NULL, size + PMALLOC_THP_SIZE, prot, flags, -1, 0);
+    PMALLOC_STAT_ADD(pmalloc_global_counters.map_calls, 1);
+    if (map == MAP_FAILED) {
+        return MAP_FAILED;
+    }
+    char *const ret =
+        (char *) pmalloc_round_up((uintptr_t) map, PMALLOC_THP_SIZE);
+    char *const map_end = map + size + PMALLOC_THP_SIZE;
+    int munmap_ret;
+    FOR_ASSERT(munmap_ret);
+    if (ret != map) {
+        munmap_ret = munmap(map, ret - map);
+        PMALLOC_STAT_ADD(pmalloc_global_counters.unmap_calls, 1);
+        assert(munmap_ret == 0);
+    }
+    if (ret + size != map_end) {
+        munmap_ret = munmap(ret + size, map_end - (ret + size));
+        PMALLOC_STAT_ADD(pmalloc_global_counters.unmap_calls, 1);
+        assert(munmap_ret == 0);
+    }
+    madvise(ret, size, MADV_HUGEPAGE);
+    PMALLOC_STAT_ADD(pmalloc_global_counters.advise_calls, 1);
+    return ret;
+}
+
+#endif
+
+
+#if defined(PMALLOC_PAGE_CACHE)
+
+/** \brief Number of size classes in the page cache
+ *
+ * Pages are put into classes by the log-base-2 of their size. A page can only
+ * be reused for a request in the same class, so at most half of it goes to
+ * waste.
+ */
+#define PMALLOC_PAGE_CACHE_CLASSES (8 * sizeof(size_t))
+/** \brief How many pages each size class can hold */
+#define PMALLOC_PAGE_CACHE_DEPTH 16
+
+/** \brief Advice given to the kernel for the contents of cached pages */
+#if defined(PMALLOC_PAGE_CACHE_LAZYFREE)
+#   define PMALLOC_PAGE_CACHE_ADVICE MADV_FREE
+#else
+#   define PMALLOC_PAGE_CACHE_ADVICE MADV_DONTNEED
+#endif
+
+/** \brief A mapping that has been freed but not unmapped */
+typedef struct pmalloc_cached_page_t {
+    void *ptr;
+    size_t size;
+} pmalloc_cached_page_t;
+
+/** \brief All the cached pages of one size class */
+typedef struct pmalloc_page_bucket_t {
+    size_t count;
+    pmalloc_cached_page_t pages[PMALLOC_PAGE_CACHE_DEPTH];
+} pmalloc_page_bucket_t;
+
+// The cache itself. It's indexed first by whether the pages are huge, then by
+// size class. Every write must hold the mutex. The byte count and the limit are
+// also read without it, to quickly check whether a page would fit.
+static pmalloc_page_bucket_t
+    pmalloc_page_cache[2][PMALLOC_PAGE_CACHE_CLASSES];
+static size_t pmalloc_page_cache_bytes = 0;
+static size_t pmalloc_page_cache_limit = PMALLOC_PAGE_CACHE_MAXBYTES;
+#if defined(PMALLOC_PTHREADS)
+    static pmalloc_mutex_t pmalloc_page_cache_mutex =
+        PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static void pmalloc_page_cache_lock(void) {
+    #if defined(PMALLOC_PTHREADS)
+        pmalloc_lock_mutex(&pmalloc_page_cache_mutex);
+    #endif
+}
+
+static void pmalloc_page_cache_unlock(void) {
+    #if defined(PMALLOC_PTHREADS)
+        pmalloc_unlock_mutex(&pmalloc_page_cache_mutex);
+    #endif
+}
+
+/** \brief Compute the size class of a page */
+static size_t pmalloc_page_class(size_t size) {
+    assert(size > 0);
+    return PMALLOC_PAGE_CACHE_CLASSES - 1 - __builtin_clzl(size);
+}
+
+/** \brief Whether a mapping might be backed by huge pages
+ *
+ * We don't remember how each page was mapped. Instead, we guess based on its
+ * size and alignment. This never misses a huge page. It might mistake a normal
+ * page for a huge one, but that just means a normal page is handed out when a
+ * huge one could have been.
+ */
+static bool pmalloc_page_is_huge(void *ptr, size_t size) {
+    #if defined(PMALLOC_HUGETLB)
+        return os_huge_sizes_count != 0
+            && size % os_huge_sizes[0].size == 0
+            && (uintptr_t) ptr % os_huge_sizes[0].size == 0;
+    #else
+        (void) ptr;
+        (void) size;
+        return false;
+    #endif
+}
+
+/** \brief Take a page of at least `*size` bytes from the cache
+ *
+ * The page is readable and writable. Its contents are zero unless
+ * `PMALLOC_PAGE_CACHE_LAZYFREE` is set, in which case they are unspecified.
+ *
+ * \param [inout] size Minimum size of the page. Return its actual size.
+ * \param huge Whether the page should be a huge page
+ * \return Pointer to the start of the page, or `NULL` if none are cached
+ */
+static void *pmalloc_page_cache_get(size_t *size, bool huge) {
+    pmalloc_page_bucket_t *const bucket =
+        &pmalloc_page_cache[huge][pmalloc_page_class(*size)];
+    void *ret = NULL;
+
+    pmalloc_page_cache_lock();
+    // Find the smallest page that's big enough
+    size_t best = bucket->count;
+    for (size_t i = 0; i < bucket->count; i++) {
+        if (bucket->pages[i].size < *size) {
+            continue;
+        }
+        if (best == bucket->count
+                || bucket->pages[i].size < bucket->pages[best].size) {
+            best = i;
+        }
+    }
+    // Take it out of the bucket by moving the last one into its place
+    if (best != bucket->count) {
+        ret = bucket->pages[best].ptr;
+        *size = bucket->pages[best].size;
+        bucket->pages[best] = bucket->pages[--bucket->count];
+        PMALLOC_ATOMIC_STORE(
+            &pmalloc_page_cache_bytes, pmalloc_page_cache_bytes - *size);
+        PMALLOC_STAT_ADD(pmalloc_global_counters.page_cache_hits, 1);
+        PMALLOC_STAT_SUB(pmalloc_global_counters.page_cache_bytes, *size);
+    }
+    pmalloc_page_cache_unlock();
+
+    return ret;
+}
+
+/** \brief Try to put a freed page into the cache
+ *
+ * Before the page is cached, it's made writable again and its memory is given
+ * back to the OS. That means it doesn't count towards the process's RSS, but
+ * the mapping still exists.
+ *
+ * \return Whether the page was cached. If not, it still has to be unmapped.
+ */
+static bool pmalloc_page_cache_put(void *ptr, size_t size) {
+    const bool huge = pmalloc_page_is_huge(ptr, size);
+    pmalloc_page_bucket_t *const bucket =
+        &pmalloc_page_cache[huge][pmalloc_page_class(size)];
+
+    // Check if there's room before making any system calls. We don't hold the
+    // lock, so we'll have to check again later.
+    if (PMALLOC_ATOMIC_LOAD(&pmalloc_page_cache_bytes) + size
+            > PMALLOC_ATOMIC_LOAD(&pmalloc_page_cache_limit)) {
+        return false;
+    }
+    // Reset the page. Some kernels don't support `madvise` on huge pages. If it
+    // fails, just unmap the page.
+    if (pmalloc_mprotect(ptr, size, true) != 0) {
+        return false;
+    }
+    #if defined(PMALLOC_NUMA)
+        if (PMALLOC_ATOMIC_LOAD(&pmalloc_numa_used)) {
+            pmalloc_mbind(ptr, size, MPOL_DEFAULT, 0);
+        }
+    #endif
+    PMALLOC_STAT_ADD(pmalloc_global_counters.advise_calls, 1);
+    if (madvise(ptr, size, PMALLOC_PAGE_CACHE_ADVICE) != 0) {
+        return false;
+    }
+
+    bool ret = false;
+    pmalloc_page_cache_lock();
+    if (pmalloc_page_cache_bytes + size <= pmalloc_page_cache_limit
+            && bucket->count < PMALLOC_PAGE_CACHE_DEPTH) {
+        bucket->pages[bucket->count].ptr = ptr;
+        bucket->pages[bucket->count].size = size;
+        bucket->count++;
+        PMALLOC_ATOMIC_STORE(
+            &pmalloc_page_cache_bytes, pmalloc_page_cache_bytes + size);
+        PMALLOC_STAT_ADD(pmalloc_global_counters.page_cache_bytes, size);
+        ret = true;
+    }
+    pmalloc_page_cache_unlock();
+    return ret;
+}
+
+PMALLOC_API size_t pmalloc_set_page_cache_limit(size_t limit) {
+    pmalloc_page_cache_lock();
+    const size_t ret = pmalloc_page_cache_limit;
+    PMALLOC_ATOMIC_STORE(&pmalloc_page_cache_limit, limit);
+    // Unmap pages until we're under the new limit. Start with the biggest
+    // pages, since they get us there the fastest.
+    for (size_t c = PMALLOC_PAGE_CACHE_CLASSES; c-- > 0;) {
+        for (size_t h = 0; h < 2; h++) {
+            pmalloc_page_bucket_t *const bucket = &pmalloc_page_cache[h][c];
+            while (pmalloc_page_cache_bytes > limit && bucket->count > 0) {
+                const pmalloc_cached_page_t page =
+                    bucket->pages[--bucket->count];
+                PMALLOC_ATOMIC_STORE(
+                    &pmalloc_page_cache_bytes,
+                    pmalloc_page_cache_bytes - page.size);
+                PMALLOC_STAT_SUB(
+                    pmalloc_global_counters.page_cache_bytes, page.size);
+                PMALLOC_STAT_ADD(pmalloc_global_counters.unmap_calls, 1);
+                int munmap_ret = munmap(page.ptr, page.size);
+                FOR_ASSERT(munmap_ret);
+                assert(munmap_ret == 0);
+            }
+        }
+    }
+    pmalloc_page_cache_unlock();
+    return ret;
+}
+
+#endif
+
+
+#if defined(PMALLOC_HUGETLB)
+
+/** \brief Read a number from a file in `dir`
+ * \return The number, or zero if the file couldn't be read
+ */
+static size_t pmalloc_read_sysfs(const char *dir, const char *file) {
+    char path[256];
+    if ((size_t) snprintf(path, sizeof(path), "%s/%s", dir, file)
+            >= sizeof(path)) {
+        return 0;
+    }
+    FILE *const f = fopen(path, "r");
+    if (f == NULL) {
+        return 0;
+    }
+    size_t ret;
+    if (fscanf(f, "%zu", &ret) != 1) {
+        ret = 0;
+    }
+    fclose(f);
+    return ret;
+}
+
+/** \brief Find all the huge page sizes the kernel supports
+ *
+ * Each size has its own directory in sysfs, named like `hugepages-2048kB`.
+ * If there isn't a directory, say because the kernel was built without
+ * HugeTLB, there are no sizes and we always use normal pages.
+ */
+static void pmalloc_probe_huge_sizes(void) {
+    DIR *const dir = opendir(PMALLOC_HUGETLB_SYSFS);
+    if (dir == NULL) {
+        return;
+    }
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL) {
+        size_t size_kb;
+        if (sscanf(ent->d_name, "hugepages-%zukB", &size_kb) != 1) {
+            continue;
+        }
+        if (os_huge_sizes_count == PMALLOC_HUGETLB_MAXSIZES) {
+            break;
+        }
+        char path[256];
+        if ((size_t) snprintf(
+                path, sizeof(path), "%s/%s",
+                PMALLOC_HUGETLB_SYSFS, ent->d_name) >= sizeof(path)) {
+            continue;
+        }
+        // Insert it in order
+        pmalloc_huge_size_t new_size;
+        new_size.size = size_kb * 1024;
+        new_size.free = pmalloc_read_sysfs(path, "free_hugepages");
+        new_size.overcommit =
+            pmalloc_read_sysfs(path, "nr_overcommit_hugepages") != 0;
+        size_t i = os_huge_sizes_count++;
+        while (i > 0 && os_huge_sizes[i - 1].size > new_size.size) {
+            os_huge_sizes[i] = os_huge_sizes[i - 1];
+            i--;
+        }
+        os_huge_sizes[i] = new_size;
+    }
+    closedir(dir);
+    #if defined(PMALLOC_AGGRESSIVE_PAGESIZE_CHECKS)
+        assert(os_huge_sizes_count == 0 || os_huge_sizes[0].size == 2097152);
+    #endif
+}
+
+/** \brief Guess which size of huge page a mapping is made of
+ *
+ * This is the biggest size that the mapping is aligned to and a multiple of.
+ * Guessing too big is harmless, since the real size divides it.
+ *
+ * \return The size, or `NULL` if the mapping can't be made of huge pages
+ */
+static pmalloc_huge_size_t *pmalloc_huge_size_of(void *ptr, size_t size) {
+    for (size_t i = os_huge_sizes_count; i-- > 0;) {
+        pmalloc_huge_size_t *const huge = &os_huge_sizes[i];
+        if (size % huge->size == 0 && (uintptr_t) ptr % huge->size == 0) {
+            return huge;
+        }
+    }
+    return NULL;
+}
+
+/** \brief Try to map `*size` bytes with huge pages of one size
+ *
+ * The page is taken from the cache if possible. Otherwise, this fails without
+ * a system call if there aren't enough free huge pages as far as we know.
+ *
+ * \param [inout] size Minimum size of the mapping. Return its actual size.
+ * \param [out] seal_size Set to the size of the huge pages in the mapping
+ * \param [out] cached Set to whether the mapping came from the cache
+ * \return The mapping, or `NULL` on failure
+ */
+static void *pmalloc_map_huge(
+    pmalloc_huge_size_t *huge,
+    size_t *size,
+    size_t *seal_size,
+    bool *cached
+) {
+    const size_t huge_size = pmalloc_round_up(*size, huge->size);
+    const size_t count = huge_size / huge->size;
+
+    // Cached pages might have been mapped with bigger huge pages than these
+    #if defined(PMALLOC_PAGE_CACHE)
+        size_t cached_size = huge_size;
+        void *const cached_page = pmalloc_page_cache_get(&cached_size, true);
+        if (cached_page != NULL) {
+            const pmalloc_huge_size_t *const cached_huge =
+                pmalloc_huge_size_of(cached_page, cached_size);
+            assert(cached_huge != NULL);
+            *size = cached_size;
+            *seal_size = cached_huge->size;
+            *cached = true;
+            return cached_page;
+        }
+    #endif
+
+    // Claim the pages from our count before trying, so that other threads
+    // don't also try for the last ones
+    size_t free = PMALLOC_ATOMIC_LOAD(&huge->free);
+    do {
+        if (free < count && !huge->overcommit) {
+            return NULL;
+        }
+    } while (!PMALLOC_ATOMIC_CAS(
+        &huge->free, &free, free < count ? 0 : free - count));
+
+    // The log-base-2 of the page size goes in the flags
+    const int log_size = __builtin_ctzl(huge->size);
+    PMALLOC_STAT_ADD(pmalloc_global_counters.map_calls, 1);
+    void *const ret = mmap(
+        NULL, huge_size,
+        PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB
+            | (log_size << MAP_HUGE_SHIFT),
+        -1, 0);
+    assert(ret != MAP_FAILED || errno == ENOMEM || errno == EINVAL);
+    if (ret == MAP_FAILED) {
+        // Someone else took the pages. Don't try again until some are freed.
+        PMALLOC_ATOMIC_STORE(&huge->free, 0);
+        return NULL;
+    }
+    *size = huge_size;
+    *seal_size = huge->size;
+    return ret;
+}
+
+/** \brief Account for huge pages being given back to the kernel
+ *
+ * Like pmalloc_page_is_huge(), this guesses based on the size and alignment.
+ * Mistaking a normal page for a huge one just makes the hint too high.
+ */
+static void pmalloc_unmap_huge(void *ptr, size_t size) {
+    pmalloc_huge_size_t *const huge = pmalloc_huge_size_of(ptr, size);
+    if (huge != NULL) {
+        PMALLOC_ATOMIC_ADD(&huge->free, size / huge->size);
+    }
+}
+
+#endif
+
+
+/** \brief Find the page sizes the OS supports
+ *
+ * This is called by pmalloc_init(), so it only ever runs once.
+ */
+static void pmalloc_init_once(void) {
+    #if defined(PMALLOC_ROUND_PAGESIZE)
+        const ssize_t sysconf_ret = sysconf(_SC_PAGE_SIZE);
+        assert(sysconf_ret > 0);
+        os_page_size = sysconf_ret;
+        #if defined(PMALLOC_AGGRESSIVE_PAGESIZE_CHECKS)
+            assert(os_page_size == 4096);
+        #endif
+    #endif
+    #if defined(PMALLOC_HUGETLB)
+        pmalloc_probe_huge_sizes();
+    #endif
+    // This disables writes to the key in this thread. Threads started after
+    // this inherit that. Threads that already exist can't access it at all.
+    #if defined(PMALLOC_PKEYS)
+        pmalloc_pkey = pkey_alloc(0, PKEY_DISABLE_WRITE);
+    #endif
+    #if defined(PMALLOC_NUMA)
+        pmalloc_probe_numa_nodes();
+    #endif
+}
+
+#if defined(PMALLOC_PTHREADS)
+    static pthread_once_t pmalloc_init_control = PTHREAD_ONCE_INIT;
+#else
+    static bool pmalloc_init_done = false;
+#endif
+
+PMALLOC_API void pmalloc_init(void) {
+    #if defined(PMALLOC_PTHREADS)
+        int ret = pthread_once(&pmalloc_init_control, pmalloc_init_once);
+        FOR_ASSERT(ret);
+        assert(ret == 0);
+    #else
+        if (!pmalloc_init_done) {
+            pmalloc_init_once();
+            pmalloc_init_done = true;
+        }
+    #endif
+}
 
-void *pmalloc_alloc_page(size_t *size) {
+/** \brief Initialize the library when it's loaded
+ *
+ * That way, the first allocation doesn't have to. Consumers can still call
+ * pmalloc_init() themselves if they need to control when it happens.
+ */
+__attribute__((constructor)) static void pmalloc_init_constructor(void) {
+    pmalloc_init();
+}
+
+
+void *pmalloc_alloc_page(size_t *size, size_t *seal_size, bool *cached) {
     assert(size);
     assert(*size > 0);
+    assert(seal_size);
+    assert(cached);
     void *ret;
+    *seal_size = pmalloc_get_page_size();
+    *cached = false;
 
-    // Get the page sizes if we have to. If we're using huge pages, we might
-    // need to fall back to normal pages.
+    // Make sure we know the page sizes. This is cheap after the first time.
+    pmalloc_init();
     #if defined(PMALLOC_ROUND_PAGESIZE)
-        static size_t page_size = 0;
-        if (page_size == 0) {
-            const ssize_t sysconf_ret = sysconf(_SC_PAGE_SIZE);
-            assert(sysconf_ret != -1l);
-            assert(sysconf_ret != 0l);
-            page_size = sysconf_ret;
-            #if defined(PMALLOC_AGGRESSIVE_PAGESIZE_CHECKS)
-                assert(page_size == 4096);
-            #endif
-        }
-    #   if defined(PMALLOC_HUGETLB)
-            static size_t huge_page_size = 0;
-            if (huge_page_size == 0) {
-                // Doesn't seem to be a way to get huge page size
-                // programmatically. Have to use `/proc/meminfo`.
-                FILE *f = fopen(PMALLOC_PROC_MOUNT "/meminfo", "r");
-                assert(f);
-                // Read the entire file into RAM
-                char *fdata;
-                {
-                    fdata = calloc(PMALLOC_MEMINFO_MAXSIZE + 1, 1);
-                    fread(fdata, 1, PMALLOC_MEMINFO_MAXSIZE, f);
-                    assert(feof(f));
-                }
-                // Get the start of the line
-                char *find;
-                {
-                    find = strstr(fdata, PMALLOC_MEMINFO_HUGEPAGE);
-                    assert(find);
-                }
-                // Increment to the data
-                find += strlen(PMALLOC_MEMINFO_HUGEPAGE);
-                while (*find == ' ')
-                    find++;
-                // Set a null terminator at the next space
-                char *end;
-                {
-                    end = find;
-                    while (*end != ' ') {
-                        assert('0' <= *end && *end <= '9');
-                        end++;
-                    }
-                    *end = 0;
-                }
-                // Assert we have the right units
-                assert(end[1] == 'k');
-                assert(end[2] == 'B');
-                assert(end[3] == '\n');
-                // Get the size
-                huge_page_size = atoi(find) * 1024;
-                assert(huge_page_size != 0);
-                assert(huge_page_size > page_size);
-                #if defined(PMALLOC_AGGRESSIVE_PAGESIZE_CHECKS)
-                    assert(huge_page_size == 2097152);
-                #endif
-                // Free everything
-                free(fdata);
-                fclose(f);
-            }
-    #   endif
+        const size_t page_size = os_page_size;
     #endif
 
-    // Compute the size to allocate in each page
-    #if defined(PMALLOC_ROUND_PAGESIZE)
+    // Compute the size to allocate in each page. Pages big enough to hold a
+    // transparent huge page are rounded up to a whole number of them, since
+    // the kernel can't use a huge page that's only partly mapped. Smaller pages
+    // wouldn't benefit, so they're left alone.
+    #if defined(PMALLOC_THP)
+        assert(PMALLOC_THP_SIZE % page_size == 0);
+        const bool thp = *size >= PMALLOC_THP_SIZE;
+        const size_t size_page =
+            pmalloc_round_up(*size, thp ? PMALLOC_THP_SIZE : page_size);
+    #elif defined(PMALLOC_ROUND_PAGESIZE)
         const size_t size_page = pmalloc_round_up(*size, page_size);
-    #   if defined(PMALLOC_HUGETLB)
-            const size_t size_huge_page =
-                pmalloc_round_up(*size, huge_page_size);
-    #   endif
     #endif
 
-    // Try HugeTLB
+    // Try HugeTLB, from the largest size that the page fills to the smallest
+    // size. Everything can go in the smallest huge page size, so we always try
+    // that one. If none of them work, carry on with normal pages.
     #if defined(PMALLOC_HUGETLB)
-        ret = mmap(
-            NULL, size_huge_page,
-            PROT_READ | PROT_WRITE,
-            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,
-            -1, 0);
-        assert(ret != MAP_FAILED || errno == ENOMEM);
-        // If we succeed, great. If not, carry on.
-        if (ret != MAP_FAILED) {
-            *size = size_huge_page;
-            return ret;
+        for (size_t i = os_huge_sizes_count; i-- > 0;) {
+            if (i != 0 && *size < os_huge_sizes[i].size) {
+                continue;
+            }
+            ret = pmalloc_map_huge(
+                &os_huge_sizes[i], size, seal_size, cached);
+            if (ret != NULL) {
+                return ret;
+            }
         }
     #endif
 
@@ -137,7 +739,26 @@ void *pmalloc_alloc_page(size_t *size) {
     #if defined(PMALLOC_ROUND_PAGESIZE)
         *size = size_page;
     #endif
+    // Reuse a cached page if we can
+    #if defined(PMALLOC_PAGE_CACHE)
+        ret = pmalloc_page_cache_get(size, false);
+        if (ret != NULL) {
+            *cached = true;
+            return ret;
+        }
+    #endif
     // Do the allocation
+    #if defined(PMALLOC_THP)
+        if (thp) {
+            ret = pmalloc_map_thp(
+                *size,
+                PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS);
+            assert(ret != MAP_FAILED);
+            return ret;
+        }
+    #endif
+    PMALLOC_STAT_ADD(pmalloc_global_counters.map_calls, 1);
     ret = mmap(
         NULL, *size,
         PROT_READ | PROT_WRITE,
@@ -151,19 +772,289 @@ void *pmalloc_alloc_page(size_t *size) {
 void pmalloc_free_page(void *ptr, size_t size) {
     assert(ptr);
     assert(size > 0);
+    #if defined(PMALLOC_PAGE_CACHE)
+        if (pmalloc_page_cache_put(ptr, size)) {
+            return;
+        }
+    #endif
+    #if defined(PMALLOC_HUGETLB)
+        pmalloc_unmap_huge(ptr, size);
+    #endif
+    PMALLOC_STAT_ADD(pmalloc_global_counters.unmap_calls, 1);
+    int ret = munmap(ptr, size);
+    FOR_ASSERT(ret);
+    assert(ret == 0);
+}
+
+bool pmalloc_markro_page(void *ptr, size_t size) {
+    assert(ptr);
+    assert(size > 0);
+    // Pages committed from an arena might not have called this yet
+    pmalloc_init();
+    if (pmalloc_mprotect(ptr, size, false) != 0) {
+        return false;
+    }
+
+    // Protected memory is read often and never written, so it's worth paying
+    // to put it in huge pages now rather than waiting for `khugepaged`. Only
+    // huge pages entirely in the range can be collapsed. Anything else would
+    // have memory with other permissions in it. This is best effort, so errors
+    // are ignored.
+    #if defined(PMALLOC_THP_COLLAPSE)
+        const uintptr_t collapse_start =
+            pmalloc_round_up((uintptr_t) ptr, PMALLOC_THP_SIZE);
+        const uintptr_t collapse_end =
+            pmalloc_round_down((uintptr_t) ptr + size, PMALLOC_THP_SIZE);
+        if (collapse_start < collapse_end) {
+            PMALLOC_STAT_ADD(pmalloc_global_counters.advise_calls, 1);
+            madvise(
+                (void *) collapse_start, collapse_end - collapse_start,
+                MADV_COLLAPSE);
+        }
+    #endif
+    return true;
+}
+
+bool pmalloc_markrw_page(void *ptr, size_t size) {
+    assert(ptr);
+    assert(size > 0);
+    return pmalloc_mprotect(ptr, size, true) == 0;
+}
+
+bool pmalloc_write_begin(void *ptr, size_t size) {
+    #if defined(PMALLOC_PKEYS)
+        if (pmalloc_pkey != -1) {
+            pkey_set(pmalloc_pkey, 0);
+            return true;
+        }
+    #endif
+    return pmalloc_markrw_page(ptr, size);
+}
+
+bool pmalloc_write_end(void *ptr, size_t size) {
+    #if defined(PMALLOC_PKEYS)
+        if (pmalloc_pkey != -1) {
+            pkey_set(pmalloc_pkey, PKEY_DISABLE_WRITE);
+            return true;
+        }
+    #endif
+    return pmalloc_markro_page(ptr, size);
+}
+
+void pmalloc_prefault_page(void *ptr, size_t size) {
+    assert(ptr);
+    assert(size > 0);
+    PMALLOC_STAT_ADD(pmalloc_global_counters.advise_calls, 1);
+    if (madvise(ptr, size, MADV_POPULATE_WRITE) == 0) {
+        return;
+    }
+    const size_t page_size = pmalloc_get_page_size();
+    for (size_t i = 0; i < size; i += page_size) {
+        ((volatile char *) ptr)[i] = 0;
+    }
+}
+
+bool pmalloc_discard_page(void *ptr, size_t size) {
+    assert(ptr);
+    assert(size > 0);
+    PMALLOC_STAT_ADD(pmalloc_global_counters.advise_calls, 1);
+    return madvise(ptr, size, MADV_DONTNEED) == 0;
+}
+
+size_t pmalloc_get_page_size(void) {
+    const ssize_t ret = sysconf(_SC_PAGE_SIZE);
+    assert(ret > 0);
+    return ret;
+}
+
+void *pmalloc_reserve_page(size_t *size) {
+    assert(size);
+    assert(*size > 0);
+    // Don't reserve swap for this region. We're not using it yet. With
+    // transparent huge pages, the advice is given for the whole region up
+    // front, and it carries over to the pages committed from it.
+    #if defined(PMALLOC_THP)
+        if (*size >= PMALLOC_THP_SIZE) {
+            *size = pmalloc_round_up(*size, PMALLOC_THP_SIZE);
+            void *ret = pmalloc_map_thp(
+                *size,
+                PROT_NONE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE);
+            assert(ret != MAP_FAILED);
+            return ret;
+        }
+    #endif
+    *size = pmalloc_round_up(*size, pmalloc_get_page_size());
+    PMALLOC_STAT_ADD(pmalloc_global_counters.map_calls, 1);
+    void *ret = mmap(
+        NULL, *size,
+        PROT_NONE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+        -1, 0);
+    FOR_ASSERT(ret);
+    assert(ret != MAP_FAILED);
+    return ret;
+}
+
+void pmalloc_commit_page(void *ptr, size_t *size) {
+    assert(ptr);
+    assert(size);
+    assert(*size > 0);
+    // Always round up. The next commit has to start on a page boundary.
+    *size = pmalloc_round_up(*size, pmalloc_get_page_size());
+    PMALLOC_STAT_ADD(pmalloc_global_counters.map_calls, 1);
+    int ret = mprotect(ptr, *size, PROT_READ | PROT_WRITE);
+    FOR_ASSERT(ret);
+    assert(ret == 0);
+}
+
+void pmalloc_release_page(void *ptr, size_t size) {
+    assert(ptr);
+    assert(size > 0);
+    PMALLOC_STAT_ADD(pmalloc_global_counters.unmap_calls, 1);
     int ret = munmap(ptr, size);
     FOR_ASSERT(ret);
     assert(ret == 0);
 }
 
-void pmalloc_markro_page(void *ptr, size_t size) {
+#if defined(PMALLOC_MEMFD)
+
+int pmalloc_create_fd(void) {
+    int ret = memfd_create("pmalloc", MFD_CLOEXEC);
+    assert(ret >= 0);
+    return ret;
+}
+
+int pmalloc_open_fd(const char *path, bool create) {
+    assert(path);
+    const int flags = create
+        ? O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC
+        : O_RDONLY | O_CLOEXEC;
+    return open(path, flags, 0666);
+}
+
+void pmalloc_close_fd(int fd) {
+    assert(fd >= 0);
+    int ret = close(fd);
+    FOR_ASSERT(ret);
+    assert(ret == 0);
+}
+
+void pmalloc_commit_fd_page(void *ptr, size_t *size, int fd, size_t offset) {
+    assert(ptr);
+    assert(size);
+    assert(*size > 0);
+    assert(fd >= 0);
+    *size = pmalloc_round_up(*size, pmalloc_get_page_size());
+    assert(offset % pmalloc_get_page_size() == 0);
+
+    // Pages are committed in order, so the file usually has to grow. Mapping
+    // past its end would fault on access.
+    struct stat st;
+    int ret = fstat(fd, &st);
+    FOR_ASSERT(ret);
+    assert(ret == 0);
+    if ((size_t) st.st_size < offset + *size) {
+        ret = ftruncate(fd, offset + *size);
+        assert(ret == 0);
+    }
+
+    // Replace the reservation with the file
+    PMALLOC_STAT_ADD(pmalloc_global_counters.map_calls, 1);
+    void *map_ret = mmap(
+        ptr, *size,
+        PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_FIXED,
+        fd, offset);
+    FOR_ASSERT(map_ret);
+    assert(map_ret == ptr);
+}
+
+void *pmalloc_attach_fd_page(void *ptr, size_t size, int fd) {
+    assert(size > 0);
+    assert(fd >= 0);
+    PMALLOC_STAT_ADD(pmalloc_global_counters.map_calls, 1);
+    void *ret = mmap(
+        ptr, size,
+        PROT_READ,
+        ptr != NULL ? MAP_SHARED | MAP_FIXED_NOREPLACE : MAP_SHARED,
+        fd, 0);
+    if (ret == MAP_FAILED) {
+        return NULL;
+    }
+    // Kernels older than 4.17 treat the address as a hint instead of failing
+    if (ptr != NULL && ret != ptr) {
+        PMALLOC_STAT_ADD(pmalloc_global_counters.unmap_calls, 1);
+        munmap(ret, size);
+        return NULL;
+    }
+    return ret;
+}
+
+void pmalloc_sync_page(void *ptr, size_t size) {
     assert(ptr);
     assert(size > 0);
-    int ret =  mprotect(ptr, size, PROT_READ);
+    int ret = msync(ptr, size, MS_SYNC);
     FOR_ASSERT(ret);
     assert(ret == 0);
 }
 
+bool pmalloc_read_fd(int fd, void *buf, size_t size) {
+    assert(fd >= 0);
+    assert(buf);
+    return pread(fd, buf, size, 0) == (ssize_t) size;
+}
+
+#endif  // PMALLOC_MEMFD
+
+#if defined(PMALLOC_NUMA)
+
+void pmalloc_numa_page(void *ptr, size_t size, unsigned policy, int node) {
+    assert(ptr);
+    assert(size > 0);
+    pmalloc_init();
+    switch (policy) {
+        case PMALLOC_NUMA_LOCAL:
+            pmalloc_mbind(ptr, size, MPOL_LOCAL, 0);
+            break;
+        case PMALLOC_NUMA_BIND:
+            assert(node >= 0 && node < PMALLOC_NUMA_MAXNODES);
+            pmalloc_mbind(ptr, size, MPOL_BIND, 1ull << node);
+            break;
+        case PMALLOC_NUMA_INTERLEAVE:
+            pmalloc_mbind(ptr, size, MPOL_INTERLEAVE, pmalloc_numa_allowed);
+            break;
+        default:
+            return;
+    }
+    if (!PMALLOC_ATOMIC_LOAD(&pmalloc_numa_used)) {
+        PMALLOC_ATOMIC_STORE(&pmalloc_numa_used, true);
+    }
+}
+
+uint64_t pmalloc_numa_nodes(void) {
+    pmalloc_init();
+    return pmalloc_numa_allowed;
+}
+
+int pmalloc_numa_node(void) {
+    unsigned cpu;
+    unsigned node;
+    #if defined(PMALLOC_NUMA_GETCPU)
+        // This goes through the vDSO where it can
+        if (getcpu(&cpu, &node) != 0) {
+            return 0;
+        }
+    #else
+        if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0) {
+            return 0;
+        }
+    #endif
+    return node < PMALLOC_NUMA_MAXNODES ? (int) node : 0;
+}
+
+#endif  // PMALLOC_NUMA
+
 
 #if defined(PMALLOC_THREADS)
 #   if defined(PMALLOC_PTHREADS)
@@ -37,10 +37,30 @@ void pmalloc_free_pool(void* ptr) {
     free(ptr);
 }
 
+void* pmalloc_alloc_heap(size_t size) {
+    assert(size > 0);
+    void* ret = malloc(size);
+    assert(ret);
+    return ret;
+}
+
+void pmalloc_free_heap(void* ptr) {
+    assert(ptr);
+    free(ptr);
+}
+
 
-void* pmalloc_alloc_page(size_t* size) {
+PMALLOC_API void pmalloc_init(void) {
+    // Nothing to do. The page size is cheap to get on Windows.
+}
+
+void* pmalloc_alloc_page(size_t* size, size_t* seal_size, bool* cached) {
     assert(size);
     assert(*size > 0);
+    assert(seal_size);
+    assert(cached);
+    *seal_size = pmalloc_get_page_size();
+    *cached = false;
 
     // Get the page sizes if we have to.
     #if defined(PMALLOC_ROUND_PAGESIZE)
@@ -62,6 +82,7 @@ void* pmalloc_alloc_page(size_t* size) {
     #endif
 
     // Allocate
+    PMALLOC_STAT_ADD(pmalloc_global_counters.map_calls, 1);
     LPVOID ret = VirtualAlloc(
         NULL, *size,
         MEM_COMMIT | MEM_RESERVE,
@@ -74,18 +95,87 @@ void* pmalloc_alloc_page(size_t* size) {
 void pmalloc_free_page(void* ptr, size_t size) {
     assert(ptr);
     assert(size > 0);
+    PMALLOC_STAT_ADD(pmalloc_global_counters.unmap_calls, 1);
     bool ret = VirtualFree(ptr, 0, MEM_RELEASE);
     FOR_ASSERT(ret);
     assert(ret);
 }
 
-void pmalloc_markro_page(void* ptr, size_t size) {
+bool pmalloc_markro_page(void* ptr, size_t size) {
+    assert(ptr);
+    assert(size > 0);
+    DWORD old_protect;
+    PMALLOC_STAT_ADD(pmalloc_global_counters.protect_calls, 1);
+    return VirtualProtect(ptr, size, PAGE_READONLY, &old_protect);
+}
+
+bool pmalloc_markrw_page(void* ptr, size_t size) {
     assert(ptr);
     assert(size > 0);
     DWORD old_protect;
-    bool ret = VirtualProtect(ptr, size, PAGE_READONLY, &old_protect);
+    PMALLOC_STAT_ADD(pmalloc_global_counters.protect_calls, 1);
+    return VirtualProtect(ptr, size, PAGE_READWRITE, &old_protect);
+}
+
+bool pmalloc_write_begin(void* ptr, size_t size) {
+    return pmalloc_markrw_page(ptr, size);
+}
+
+bool pmalloc_write_end(void* ptr, size_t size) {
+    return pmalloc_markro_page(ptr, size);
+}
+
+void pmalloc_prefault_page(void* ptr, size_t size) {
+    assert(ptr);
+    assert(size > 0);
+    const size_t page_size = pmalloc_get_page_size();
+    for (size_t i = 0; i < size; i += page_size) {
+        ((volatile char*) ptr)[i] = 0;
+    }
+}
+
+bool pmalloc_discard_page(void* ptr, size_t size) {
+    assert(ptr);
+    assert(size > 0);
+    // The protection is ignored when resetting
+    PMALLOC_STAT_ADD(pmalloc_global_counters.advise_calls, 1);
+    return VirtualAlloc(ptr, size, MEM_RESET, PAGE_NOACCESS) != NULL;
+}
+
+size_t pmalloc_get_page_size(void) {
+    SYSTEM_INFO sysinfo_ret;
+    GetSystemInfo(&sysinfo_ret);
+    assert(sysinfo_ret.dwPageSize != 0);
+    return sysinfo_ret.dwPageSize;
+}
+
+void* pmalloc_reserve_page(size_t* size) {
+    assert(size);
+    assert(*size > 0);
+    PMALLOC_STAT_ADD(pmalloc_global_counters.map_calls, 1);
+    LPVOID ret = VirtualAlloc(NULL, *size, MEM_RESERVE, PAGE_NOACCESS);
+    FOR_ASSERT(ret);
+    assert(ret);
+    return ret;
+}
+
+void pmalloc_commit_page(void* ptr, size_t* size) {
+    assert(ptr);
+    assert(size);
+    assert(*size > 0);
+    // Always round up. The next commit has to start on a page boundary.
+    *size = pmalloc_round_up(*size, pmalloc_get_page_size());
+    PMALLOC_STAT_ADD(pmalloc_global_counters.map_calls, 1);
+    LPVOID ret = VirtualAlloc(ptr, *size, MEM_COMMIT, PAGE_READWRITE);
+    FOR_ASSERT(ret);
+    assert(ret == ptr);
+}
+
+void pmalloc_release_page(void* ptr, size_t size) {
+    assert(ptr);
+    assert(size > 0);
+    PMALLOC_STAT_ADD(pmalloc_global_counters.unmap_calls, 1);
+    bool ret = VirtualFree(ptr, 0, MEM_RELEASE);
     FOR_ASSERT(ret);
     assert(ret);
-    FOR_ASSERT(old_protect);
-    assert(old_protect == PAGE_READWRITE);
 }
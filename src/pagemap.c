@@ -0,0 +1,171 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2022  Ammar Ratnani <ammrat13@gmail.com>
+
+#include <assert.h>
+#include <stdint.h>
+
+#include "pmalloc/internals.h"
+
+// The map is optional
+#if !defined(PMALLOC_PAGE_MAP)
+#   error "This file should only be compiled if the page map is enabled"
+#endif
+
+/** \brief Log-base-2 of how many bytes of address space each entry covers
+ *
+ * This is the smallest OS page size there is. Pages always start on an OS page
+ * boundary, so no two pages ever share an entry. Bigger OS pages just take up
+ * more than one.
+ */
+#define PMALLOC_PAGE_MAP_SHIFT 12
+
+/** \brief How many bits of an address the map covers
+ *
+ * Pages mapped above this aren't tracked. On 64-bit platforms, the OS only
+ * hands out addresses above 47 bits when it's explicitly asked to.
+ */
+#if UINTPTR_MAX > 0xffffffffu
+#   define PMALLOC_PAGE_MAP_ADDRESS_BITS 48
+#else
+#   define PMALLOC_PAGE_MAP_ADDRESS_BITS 32
+#endif
+
+/** \brief How many bits are left of an address once the offset is dropped */
+#define PMALLOC_PAGE_MAP_KEY_BITS \
+    (PMALLOC_PAGE_MAP_ADDRESS_BITS - PMALLOC_PAGE_MAP_SHIFT)
+/** \brief How many of the key's bits index into a leaf
+ *
+ * Leaves get slightly fewer than half, so that on 64-bit platforms they're
+ * smaller than a transparent huge page. Otherwise, the first entry written
+ * would make the whole leaf resident.
+ */
+#define PMALLOC_PAGE_MAP_LEAF_BITS (PMALLOC_PAGE_MAP_KEY_BITS / 2 - 1)
+/** \brief How many of the key's bits index into the root */
+#define PMALLOC_PAGE_MAP_ROOT_BITS \
+    (PMALLOC_PAGE_MAP_KEY_BITS - PMALLOC_PAGE_MAP_LEAF_BITS)
+
+/** \brief Second level of the page map
+ *
+ * Leaves are reserved and committed, so they start out zero, and only the OS
+ * pages of them that are written take any memory. They're never freed.
+ */
+typedef struct pmalloc_page_map_leaf_t {
+    /** \brief The page covering each entry, or `NULL` if there is none
+     *
+     * Use the atomic operations in pmalloc/arch.h to access these.
+     */
+    pmalloc_page_header_t *pages[(size_t) 1 << PMALLOC_PAGE_MAP_LEAF_BITS];
+} pmalloc_page_map_leaf_t;
+
+/** \brief First level of the page map
+ *
+ * It's indexed by the top bits of the key. It's zero until it's written, so it
+ * doesn't take any memory for the parts of the address space that aren't used.
+ * Use the atomic operations in pmalloc/arch.h to access it.
+ */
+static pmalloc_page_map_leaf_t *
+    pmalloc_page_map[(size_t) 1 << PMALLOC_PAGE_MAP_ROOT_BITS];
+
+
+/** \brief Get the leaf covering `key`
+ *
+ * Leaves are made the first time a page in them is inserted. If two threads
+ * race to make the same one, the loser frees its copy.
+ *
+ * \param create Whether to make the leaf if it doesn't exist
+ * \return The leaf, or `NULL` if it doesn't exist and `create` is unset
+ */
+static pmalloc_page_map_leaf_t *pmalloc_page_map_leaf(
+    uintptr_t key,
+    bool create
+) {
+    pmalloc_page_map_leaf_t **const slot =
+        &pmalloc_page_map[key >> PMALLOC_PAGE_MAP_LEAF_BITS];
+    pmalloc_page_map_leaf_t *leaf = PMALLOC_ATOMIC_LOAD(slot);
+    if (leaf != NULL || !create) {
+        return leaf;
+    }
+
+    size_t size = sizeof(pmalloc_page_map_leaf_t);
+    pmalloc_page_map_leaf_t *const new_leaf = pmalloc_reserve_page(&size);
+    size_t commit_size = size;
+    pmalloc_commit_page(new_leaf, &commit_size);
+    while (!PMALLOC_ATOMIC_CAS(slot, &leaf, new_leaf)) {
+        if (leaf != NULL) {
+            pmalloc_release_page(new_leaf, size);
+            return leaf;
+        }
+    }
+    return new_leaf;
+}
+
+/** \brief Point every entry covering `page` to `value` */
+static void pmalloc_page_map_set(
+    const pmalloc_page_header_t *page,
+    pmalloc_page_header_t *value
+) {
+    const uintptr_t start = (uintptr_t) page->base;
+    assert(start % ((uintptr_t) 1 << PMALLOC_PAGE_MAP_SHIFT) == 0);
+    const uintptr_t first = start >> PMALLOC_PAGE_MAP_SHIFT;
+    const uintptr_t last =
+        (start + page->page_size - 1) >> PMALLOC_PAGE_MAP_SHIFT;
+    if (last >> PMALLOC_PAGE_MAP_KEY_BITS != 0) {
+        return;
+    }
+
+    const uintptr_t mask = ((uintptr_t) 1 << PMALLOC_PAGE_MAP_LEAF_BITS) - 1;
+    pmalloc_page_map_leaf_t *leaf = NULL;
+    for (uintptr_t key = first; key <= last; key++) {
+        if (leaf == NULL || (key & mask) == 0) {
+            leaf = pmalloc_page_map_leaf(key, value != NULL);
+            // Removed pages were inserted first
+            assert(leaf != NULL);
+        }
+        PMALLOC_ATOMIC_STORE(&leaf->pages[key & mask], value);
+    }
+}
+
+void pmalloc_page_map_insert(pmalloc_page_header_t *page) {
+    assert(page);
+    pmalloc_page_map_set(page, page);
+}
+
+void pmalloc_page_map_remove(pmalloc_page_header_t *page) {
+    assert(page);
+    pmalloc_page_map_set(page, NULL);
+}
+
+/** \brief Find the page holding `ptr`
+ * \return The page, or `NULL` if `ptr` isn't in any pool's pages
+ */
+static const pmalloc_page_header_t *pmalloc_page_map_find(const void *ptr) {
+    const uintptr_t key = (uintptr_t) ptr >> PMALLOC_PAGE_MAP_SHIFT;
+    if (key >> PMALLOC_PAGE_MAP_KEY_BITS != 0) {
+        return NULL;
+    }
+    const pmalloc_page_map_leaf_t *const leaf =
+        pmalloc_page_map_leaf(key, false);
+    if (leaf == NULL) {
+        return NULL;
+    }
+    const uintptr_t mask = ((uintptr_t) 1 << PMALLOC_PAGE_MAP_LEAF_BITS) - 1;
+    const pmalloc_page_header_t *const page =
+        PMALLOC_ATOMIC_LOAD(&leaf->pages[key & mask]);
+    // Pages smaller than an entry don't cover all of it
+    if (page == NULL || (const char *) ptr >= page->base + page->page_size) {
+        return NULL;
+    }
+    return page;
+}
+
+PMALLOC_API pmalloc_pool_t *pmalloc_owner(const void *ptr) {
+    const pmalloc_page_header_t *const page = pmalloc_page_map_find(ptr);
+    return page != NULL ? page->pool : NULL;
+}
+
+PMALLOC_API bool pmalloc_is_protected(const void *ptr) {
+    const pmalloc_page_header_t *const page = pmalloc_page_map_find(ptr);
+    return page != NULL
+        && (const char *) ptr >= page->base
+            + PMALLOC_ATOMIC_LOAD(&page->ro_offset);
+}
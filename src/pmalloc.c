@@ -2,79 +2,1846 @@
 // Copyright (C) 2022  Ammar Ratnani <ammrat13@gmail.com>
 
 #include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "pmalloc/internals.h"
 
+#if defined(PMALLOC_STATS)
+    pmalloc_global_stats_t pmalloc_global_counters;
+#endif
+
+/** \brief Whether all of a pool's pages have to be in its arena
+ * \sa PMALLOC_POOL_SHARED
+ */
+static inline bool pmalloc_is_shared(const pmalloc_pool_t *pool) {
+    #if defined(PMALLOC_MEMFD)
+        return pool->flags & PMALLOC_POOL_SHARED;
+    #else
+        (void) pool;
+        return false;
+    #endif
+}
+
+/** \brief How big a page has to be to hold an object
+ *
+ * This accounts for the header at the start of the page, if the pool keeps it
+ * there, and for the padding needed after it to align the object.
+ */
+static inline size_t pmalloc_min_page_size(
+    const pmalloc_pool_t *pool,
+    size_t size,
+    size_t align
+) {
+    return pmalloc_align_up(pool->header_size, align) + size;
+}
+
+/** \brief Try to allocate from a page
+ *
+ * This doesn't need the pool's lock. Instead, it claims space by moving the
+ * page's boundary pointer down with a compare-and-swap. It fails if there isn't
+ * enough space left in the page.
+ *
+ * \param [in] pool The pool the page is in
+ * \param [in] page The page to allocate in, which must not be read only
+ * \param size Number of bytes to allocate
+ * \param align The log-base-2 of the alignment needed
+ * \param min_page_size The lowest boundary pointer that still has room
+ * \return Pointer to the allocated memory, or `NULL` on failure
+ */
+static void *pmalloc_bump_page(
+    pmalloc_pool_t *pool,
+    pmalloc_page_header_t *page,
+    size_t size,
+    size_t align,
+    size_t min_page_size
+) {
+    size_t bp = PMALLOC_ATOMIC_LOAD(&page->bp_offset);
+    size_t new_bp;
+    do {
+        if (bp < min_page_size) {
+            return NULL;
+        }
+        new_bp = pmalloc_align_down(bp - size, align);
+    } while (!PMALLOC_ATOMIC_CAS(&page->bp_offset, &bp, new_bp));
+    if (new_bp != bp - size) {
+        PMALLOC_STAT_ADD(pool->stats.waste_alignment, bp - size - new_bp);
+    }
+
+    assert(new_bp >= pool->header_size);
+    assert(new_bp % (1ll << align) == 0);
+    return page->base + new_bp;
+}
+
+/** \brief Try to allocate from the head page of a pool
+ *
+ * This doesn't take the pool's lock. It fails if there is no head page, if the
+ * head page is read only, or if there isn't enough space left in it.
+ *
+ * \sa pmalloc_bump_page()
+ */
+static void *pmalloc_bump_head(
+    pmalloc_pool_t *pool,
+    size_t size,
+    size_t align,
+    size_t min_page_size
+) {
+    pmalloc_page_header_t *const head = PMALLOC_ATOMIC_LOAD(&pool->head);
+    if (head == NULL || PMALLOC_ATOMIC_LOAD(&head->ro)) {
+        return NULL;
+    }
+    return pmalloc_bump_page(pool, head, size, align, min_page_size);
+}
+
+
+/** \brief Try to allocate many objects of the same size from the head page
+ *
+ * This is like pmalloc_bump_head(), but it claims space for as many objects as
+ * will fit with a single compare-and-swap. Objects are laid out going downward,
+ * exactly as if they were allocated one at a time.
+ *
+ * \param [out] out Where to write the pointers to the objects allocated
+ * \return The number of objects allocated, at most `n`
+ */
+static size_t pmalloc_bump_head_n(
+    pmalloc_pool_t *pool,
+    size_t size,
+    size_t align,
+    size_t min_page_size,
+    size_t n,
+    void *out[]
+) {
+    pmalloc_page_header_t *const head = PMALLOC_ATOMIC_LOAD(&pool->head);
+    if (head == NULL || PMALLOC_ATOMIC_LOAD(&head->ro)) {
+        return 0;
+    }
+
+    // Once the first object is aligned, every object after it is a whole
+    // number of alignment units below it.
+    const size_t stride = pmalloc_align_up(size, align);
+    const size_t lowest = min_page_size - size;
+
+    size_t bp = PMALLOC_ATOMIC_LOAD(&head->bp_offset);
+    size_t first_bp;
+    size_t count;
+    do {
+        if (bp < min_page_size) {
+            return 0;
+        }
+        first_bp = pmalloc_align_down(bp - size, align);
+        count = (first_bp - lowest) / stride + 1;
+        count = count < n ? count : n;
+    } while (!PMALLOC_ATOMIC_CAS(
+        &head->bp_offset, &bp, first_bp - (count - 1) * stride));
+    PMALLOC_STAT_ADD(
+        pool->stats.waste_alignment,
+        (bp - size - first_bp) + (count - 1) * (stride - size));
+
+    for (size_t i = 0; i < count; i++) {
+        out[i] = head->base + first_bp - i * stride;
+    }
+    return count;
+}
+
+/** \brief Count a new page of `size` bytes in the statistics
+ * \param cached Whether the page came from the page cache without a system
+ *               call
+ */
+static inline void pmalloc_count_page(
+    pmalloc_pool_t *pool,
+    size_t size,
+    bool cached
+) {
+    (void) pool;  // Only used for statistics
+    (void) size;
+    (void) cached;
+    PMALLOC_STAT_ADD(pool->stats.map_calls, cached ? 0 : 1);
+    PMALLOC_STAT_ADD(pool->stats.pages, 1);
+    PMALLOC_STAT_ADD(pool->stats.page_bytes, size);
+    PMALLOC_STAT_ADD(pmalloc_global_counters.pages, 1);
+    PMALLOC_STAT_ADD(pmalloc_global_counters.page_bytes, size);
+}
+
+/** \brief Commit the next `*size` bytes of an arena
+ *
+ * The caller must have checked that there's room, and must hold the pool's
+ * lock.
+ *
+ * \param [inout] size How many bytes are needed. Return how many were taken.
+ */
+static void *pmalloc_commit_arena(pmalloc_arena_t *arena, size_t *size) {
+    char *const ret = arena->base + arena->committed;
+    #if defined(PMALLOC_MEMFD)
+        if (arena->fd != -1) {
+            pmalloc_commit_fd_page(ret, size, arena->fd, arena->committed);
+            // The alias gets the same part of the file
+            if (arena->alias != NULL) {
+                size_t alias_size = *size;
+                pmalloc_commit_fd_page(
+                    arena->alias + arena->committed, &alias_size,
+                    arena->fd, arena->committed);
+                assert(alias_size == *size);
+            }
+        } else {
+            pmalloc_commit_page(ret, size);
+        }
+    #else
+        pmalloc_commit_page(ret, size);
+    #endif
+    arena->committed += *size;
+    assert(arena->committed <= arena->size);
+    return ret;
+}
+
+/** \brief Take the next `*size` bytes of a group's arena if there's room
+ *
+ * Members call this with their own lock held, so it takes the group's arena
+ * lock.
+ *
+ * \param [inout] size How many bytes are needed. Return how many were taken.
+ * \return The start of the bytes taken, or `NULL` if the arena is full
+ */
+static void *pmalloc_commit_group(pmalloc_group_t *group, size_t *size) {
+    void *ret = NULL;
+    #if defined(PMALLOC_THREADS)
+        pmalloc_lock_mutex(&group->arena_mutex);
+    #endif
+    if (group->arena.size - group->arena.committed >= *size) {
+        ret = pmalloc_commit_arena(&group->arena, size);
+    }
+    #if defined(PMALLOC_THREADS)
+        pmalloc_unlock_mutex(&group->arena_mutex);
+    #endif
+    return ret;
+}
+
+/** \brief Whether `ptr` is in the region reserved for a pool's group
+ *
+ * Unlike pmalloc_in_arena(), this doesn't read how much of the region has been
+ * committed, so it doesn't need the group's arena lock.
+ */
+static inline bool pmalloc_in_group(const pmalloc_pool_t *pool, char *ptr) {
+    const pmalloc_group_t *const group = pool->group;
+    return group != NULL
+        && ptr >= group->arena.base
+        && ptr < group->arena.base + group->arena.size;
+}
+
+/** \brief Put a new page on the NUMA nodes the pool asked for
+ *
+ * This has to be done before the page is touched.
+ */
+static inline void pmalloc_place_page(
+    pmalloc_pool_t *pool,
+    void *base,
+    size_t size
+) {
+    #if defined(PMALLOC_NUMA)
+        if (pool->numa_policy != PMALLOC_NUMA_DEFAULT) {
+            pmalloc_numa_page(base, size, pool->numa_policy, pool->numa_node);
+        }
+    #else
+        (void) pool;
+        (void) base;
+        (void) size;
+    #endif
+}
+
+/** \brief Get memory for a new page spanning at least `*size` bytes
+ *
+ * This takes the page from the pool's arena, or its group's, if there's enough
+ * room left. Otherwise, it maps a new page. The caller must hold the pool's
+ * lock.
+ *
+ * \param [inout] size How many bytes the page needs. Return its actual size.
+ * \param [out] seal_size Set to what pmalloc_page_header_t::seal_size should be
+ * \return The start of the page, or `NULL` if the pool is shared and its arena
+ *         is full
+ */
+static void *pmalloc_new_page(
+    pmalloc_pool_t *pool,
+    size_t *size,
+    size_t *seal_size
+) {
+    pmalloc_arena_t *const arena = &pool->arena;
+    void *ret = NULL;
+    bool cached = false;
+    *seal_size = pmalloc_get_page_size();
+    if (pool->group != NULL) {
+        ret = pmalloc_commit_group(pool->group, size);
+    } else if (arena->base != NULL
+            && arena->size - arena->committed >= *size) {
+        ret = pmalloc_commit_arena(arena, size);
+    }
+    if (ret == NULL) {
+        // Pages outside the arena wouldn't be seen by other processes
+        if (pmalloc_is_shared(pool)) {
+            return NULL;
+        }
+        ret = pmalloc_alloc_page(size, seal_size, &cached);
+    }
+    pmalloc_place_page(pool, ret, *size);
+    pmalloc_count_page(pool, *size, cached);
+    return ret;
+}
+
+/** \brief Get a header for a page starting at `base`
+ *
+ * If the pool keeps headers in its pages, this is just the start of the page.
+ * Otherwise, the next free header is taken from the pool's table, and a new
+ * table is allocated if that one is full. The caller must hold the pool's
+ * lock.
+ */
+static pmalloc_page_header_t *pmalloc_new_header(
+    pmalloc_pool_t *pool,
+    char *base
+) {
+    if (pool->header_size != 0) {
+        return (pmalloc_page_header_t *) base;
+    }
+    pmalloc_header_table_t *table = pool->headers;
+    if (table == NULL || table->used == PMALLOC_HEADER_TABLE_SIZE) {
+        table = pmalloc_alloc_heap(sizeof(pmalloc_header_table_t));
+        table->next = pool->headers;
+        table->used = 0;
+        pool->headers = table;
+    }
+    return &table->headers[table->used++];
+}
+
+/** \brief Let pmalloc_owner() find a page
+ *
+ * This is called once for each page, after its fields are set.
+ */
+static inline void pmalloc_track_page(
+    pmalloc_pool_t *pool,
+    pmalloc_page_header_t *page
+) {
+    #if defined(PMALLOC_PAGE_MAP)
+        page->pool = pool;
+        pmalloc_page_map_insert(page);
+    #else
+        (void) pool;
+        (void) page;
+    #endif
+}
+
+/** \brief Free a page that was returned by pmalloc_new_page()
+ *
+ * Pages in the pool's arena, or its group's, aren't freed individually.
+ * They're all freed at once with the arena. Headers outside the page are freed
+ * with the pool.
+ */
+static void pmalloc_delete_page(
+    pmalloc_pool_t *pool,
+    pmalloc_page_header_t *page
+) {
+    #if defined(PMALLOC_PAGE_MAP)
+        pmalloc_page_map_remove(page);
+    #endif
+    PMALLOC_STAT_SUB(pmalloc_global_counters.pages, 1);
+    PMALLOC_STAT_SUB(pmalloc_global_counters.page_bytes, page->page_size);
+    if (!pmalloc_in_arena(&pool->arena, page->base)
+            && !pmalloc_in_group(pool, page->base)) {
+        pmalloc_free_page(page->base, page->page_size);
+    }
+}
+
+/** \brief Free a page for an object too big for a normal page
+ *
+ * Its header is freed too if it isn't in the page.
+ */
+static void pmalloc_delete_large(
+    pmalloc_pool_t *pool,
+    pmalloc_page_header_t *page
+) {
+    pmalloc_delete_page(pool, page);
+    if (pool->header_size == 0) {
+        pmalloc_free_heap(page);
+    }
+}
+
+/** \brief Put an empty page on the pool's list of spare pages
+ *
+ * The page's fields are reset as if it were new, so it has to be writable. The
+ * caller must hold the pool's lock.
+ */
+static void pmalloc_spare_page(
+    pmalloc_pool_t *pool,
+    pmalloc_page_header_t *page
+) {
+    page->bp_offset = page->page_size;
+    PMALLOC_ATOMIC_STORE(&page->ro_offset, page->page_size);
+    page->ro = false;
+    page->next = pool->spare;
+    pool->spare = page;
+}
+
+/** \brief A range of memory from `start` to `end-1`, without anything else */
+typedef struct pmalloc_span_t {
+    char *start;
+    char *end;
+} pmalloc_span_t;
+
+/** \brief Ranges put aside to have their protection changed later
+ *
+ * They're in no particular order. The array grows as needed, and it's freed
+ * with pmalloc_free_heap().
+ */
+typedef struct pmalloc_span_list_t {
+    pmalloc_span_t *spans;
+    size_t count;
+    size_t capacity;
+} pmalloc_span_list_t;
+
+/** \brief A range of memory from `start` to `end-1` */
+typedef struct pmalloc_range_t {
+    char *start;
+    char *end;
+    size_t calls;  ///< How many ranges have been changed so far
+    /** \brief How to change the range's protection
+     *
+     * This is pmalloc_markro_page() or pmalloc_markrw_page().
+     */
+    bool (*mark)(void *ptr, size_t size);
+    /** \brief Where to put ranges instead of changing them, if not `NULL`
+     *
+     * This is for sealing several pools at once, so that ranges from all of
+     * them can be coalesced. #mark isn't called, and #calls stays zero.
+     */
+    pmalloc_span_list_t *save;
+} pmalloc_range_t;
+
+/** \brief Change the protection of the range accumulated so far
+ * \sa pmalloc_seal_range()
+ */
+static void pmalloc_flush_range(pmalloc_range_t *run) {
+    pmalloc_span_list_t *const save = run->save;
+    if (run->start != run->end && save != NULL) {
+        if (save->count == save->capacity) {
+            const size_t capacity = save->capacity != 0
+                ? 2 * save->capacity
+                : PMALLOC_OPEN_PAGES;
+            pmalloc_span_t *const spans =
+                pmalloc_alloc_heap(capacity * sizeof(pmalloc_span_t));
+            if (save->spans != NULL) {
+                memcpy(
+                    spans, save->spans, save->count * sizeof(pmalloc_span_t));
+                pmalloc_free_heap(save->spans);
+            }
+            save->spans = spans;
+            save->capacity = capacity;
+        }
+        save->spans[save->count++] = (pmalloc_span_t) {run->start, run->end};
+    } else if (run->start != run->end) {
+        // There's no way to report this. Carrying on would leave objects that
+        // were meant to be sealed writable, or pages that can't be reused.
+        if (!run->mark(run->start, run->end - run->start)) {
+            abort();
+        }
+        run->calls++;
+    }
+    run->start = NULL;
+    run->end = NULL;
+}
+
+/** \brief Change the protection of a range, coalescing with others
+ *
+ * Ranges are accumulated into `run` as long as each one is adjacent to the
+ * last. When one isn't, the accumulated range is changed with a single call
+ * and a new one is started. Call pmalloc_flush_range() at the end.
+ *
+ * \param [inout] run The range accumulated so far
+ */
+static void pmalloc_seal_range(pmalloc_range_t *run, char *start, char *end) {
+    if (start == end) {
+        return;
+    }
+    if (run->start == end) {
+        run->start = start;
+        return;
+    }
+    if (run->end == start) {
+        run->end = end;
+        return;
+    }
+    pmalloc_flush_range(run);
+    run->start = start;
+    run->end = end;
+}
+
+/** \brief Seal the allocated part of a page
+ *
+ * Only the OS pages containing allocated space are sealed, or the huge pages
+ * if the page is backed by them. If the boundary pointer is in the same one as
+ * the header, the whole page is sealed and marked as read only. Otherwise, the
+ * boundary pointer is moved down to a pmalloc_page_header_t::seal_size
+ * boundary, and everything above it is sealed. The free space below stays
+ * writable.
+ *
+ * Allocations racing with us might still claim space in the page after we've
+ * looked at it. That's fine, since they overlap with this call and can be
+ * ordered before it.
+ *
+ * \param [inout] run Sealed ranges to coalesce with
+ */
+static void pmalloc_seal_page(
+    pmalloc_pool_t *pool,
+    pmalloc_page_header_t *page,
+    pmalloc_range_t *run
+) {
+    (void) pool;  // Only used for statistics
+    char *const base = page->base;
+    size_t bp = PMALLOC_ATOMIC_LOAD(&page->bp_offset);
+    size_t seal_bp;
+    do {
+        seal_bp = pmalloc_round_down(bp, page->seal_size);
+        if (seal_bp == 0) {
+            // Make sure no more allocations happen before sealing the header,
+            // which might be in the page
+            PMALLOC_ATOMIC_STORE(&page->ro, true);
+            PMALLOC_STAT_ADD(
+                pool->stats.waste_protect, bp - pool->header_size);
+            pmalloc_seal_range(run, base, base + page->ro_offset);
+            PMALLOC_ATOMIC_STORE(&page->ro_offset, 0);
+            return;
+        }
+    } while (seal_bp != bp
+        && !PMALLOC_ATOMIC_CAS(&page->bp_offset, &bp, seal_bp));
+    PMALLOC_STAT_ADD(pool->stats.waste_protect, bp - seal_bp);
+
+    pmalloc_seal_range(run, base + seal_bp, base + page->ro_offset);
+    PMALLOC_ATOMIC_STORE(&page->ro_offset, seal_bp);
+}
+
+/** \brief Whether nothing can be allocated in a page anymore
+ *
+ * That's every page in the pool's list except the head and the open pages. The
+ * head can still be allocated from once it's read only, since its free space is
+ * sealed. The caller must hold the pool's lock.
+ */
+static bool pmalloc_page_is_dead(
+    const pmalloc_pool_t *pool,
+    const pmalloc_page_header_t *page
+) {
+    if (page == pool->head && !PMALLOC_ATOMIC_LOAD(&page->ro)) {
+        return false;
+    }
+    for (size_t i = 0; i < pool->open_count; i++) {
+        if (pool->open[i] == page) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/** \brief Release the whole OS pages of free space in a page
+ *
+ * The boundary pointer is moved down past them before they're released, so an
+ * allocation racing with this can't claim them afterwards. Nothing can be
+ * allocated in the page anymore, so that's only allocations that read the head
+ * before it changed. The caller must hold the pool's lock.
+ *
+ * \return How many bytes were released
+ */
+static size_t pmalloc_trim_page(
+    pmalloc_pool_t *pool,
+    pmalloc_page_header_t *page
+) {
+    // Pages of a file stay in memory as long as the file does
+    #if defined(PMALLOC_MEMFD)
+        if (pool->arena.fd != -1
+                && pmalloc_in_arena(&pool->arena, page->base)) {
+            return 0;
+        }
+    #endif
+    const size_t low = pmalloc_round_up(pool->header_size, page->seal_size);
+    size_t bp = PMALLOC_ATOMIC_LOAD(&page->bp_offset);
+    size_t high;
+    do {
+        high = pmalloc_round_down(bp, page->seal_size);
+        if (high <= low) {
+            return 0;
+        }
+    } while (!PMALLOC_ATOMIC_CAS(&page->bp_offset, &bp, low));
+    if (!pmalloc_discard_page(page->base + low, high - low)) {
+        return 0;
+    }
+    PMALLOC_STAT_ADD(pool->stats.trimmed_bytes, high - low);
+    return high - low;
+}
+
+#if defined(PMALLOC_MULTIPAGE_ALLOC)
+/** \brief Allocate an object too big for a normal page
+ *
+ * The object gets its own mapping, which is put on the pool's list of large
+ * pages rather than becoming the head. That way, the head page can still be
+ * allocated from. The mapping is made without holding the pool's lock, and the
+ * page is pushed onto the list with a compare-and-swap. It's never taken from
+ * the arena, since that would need the lock.
+ *
+ * Shared pools are the exception. Their pages all have to be in the arena, so
+ * the caller must hold the pool's lock for them.
+ *
+ * \param min_page_size The size of page needed to hold the object
+ * \return Pointer to the allocated memory, or `NULL` if the pool is shared and
+ *         its arena is full
+ */
+static void *pmalloc_align_large(
+    pmalloc_pool_t *pool,
+    size_t size,
+    size_t align,
+    size_t min_page_size
+) {
+    size_t page_size = min_page_size;
+    size_t seal_size;
+    char *base;
+    if (pmalloc_is_shared(pool)) {
+        base = pmalloc_new_page(pool, &page_size, &seal_size);
+        if (base == NULL) {
+            return NULL;
+        }
+    } else {
+        bool cached;
+        base = pmalloc_alloc_page(&page_size, &seal_size, &cached);
+        pmalloc_place_page(pool, base, page_size);
+        pmalloc_count_page(pool, page_size, cached);
+    }
+    assert(page_size >= min_page_size);
+
+    // The header goes in the page if the pool keeps them there. Otherwise, we
+    // can't use the pool's table without the lock, so it gets its own.
+    pmalloc_page_header_t *const page = pool->header_size != 0
+        ? (pmalloc_page_header_t *) base
+        : pmalloc_alloc_heap(sizeof(pmalloc_page_header_t));
+
+    // Nothing else is ever allocated in this page, so the free space below
+    // the object is wasted right away
+    const size_t bp = pmalloc_align_down(page_size - size, align);
+    assert(bp >= pool->header_size);
+    PMALLOC_STAT_ADD(pool->stats.waste_alignment, page_size - size - bp);
+    PMALLOC_STAT_ADD(pool->stats.waste_page_tail, bp - pool->header_size);
+    page->base = base;
+    page->page_size = page_size;
+    page->seal_size = seal_size;
+    page->bp_offset = bp;
+    page->ro_offset = page_size;
+    page->ro = false;
+    pmalloc_track_page(pool, page);
+
+    // Publish it
+    page->next = PMALLOC_ATOMIC_LOAD(&pool->large);
+    while (!PMALLOC_ATOMIC_CAS(&pool->large, &page->next, page)) {
+    }
+    return base + bp;
+}
+#endif
+
+/** \brief How many bytes of a page are still free
+ *
+ * This is only accurate for pages other than the head. The head can have space
+ * claimed from it at any time.
+ */
+static inline size_t pmalloc_page_free(
+    const pmalloc_pool_t *pool,
+    pmalloc_page_header_t *page
+) {
+    return PMALLOC_ATOMIC_LOAD(&page->bp_offset) - pool->header_size;
+}
+
+/** \brief Move an open page to its place after its free space changed
+ *
+ * Free space only ever goes down, so the page only ever moves towards the
+ * start of the array. The caller must hold the pool's lock.
+ */
+static void pmalloc_open_sort(pmalloc_pool_t *pool, size_t i) {
+    pmalloc_page_header_t **const open = pool->open;
+    while (i > 0
+            && pmalloc_page_free(pool, open[i - 1])
+                > pmalloc_page_free(pool, open[i])) {
+        pmalloc_page_header_t *const tmp = open[i - 1];
+        open[i - 1] = open[i];
+        open[i] = tmp;
+        i--;
+    }
+}
+
+/** \brief Remove the open page at index `i`
+ *
+ * The caller must hold the pool's lock.
+ */
+static void pmalloc_open_remove(pmalloc_pool_t *pool, size_t i) {
+    assert(i < pool->open_count);
+    pool->open_count--;
+    for (; i < pool->open_count; i++) {
+        pool->open[i] = pool->open[i + 1];
+    }
+}
+
+/** \brief Keep a page around to allocate from later
+ *
+ * If there are already #PMALLOC_OPEN_PAGES open pages, the one with the least
+ * free space is abandoned, which might be this one. The caller must hold the
+ * pool's lock.
+ */
+static void pmalloc_open_insert(
+    pmalloc_pool_t *pool,
+    pmalloc_page_header_t *page
+) {
+    pmalloc_page_header_t **const open = pool->open;
+    if (pool->open_count == PMALLOC_OPEN_PAGES) {
+        if (pmalloc_page_free(pool, page) <= pmalloc_page_free(pool, open[0])) {
+            PMALLOC_STAT_ADD(
+                pool->stats.waste_page_tail, pmalloc_page_free(pool, page));
+            return;
+        }
+        PMALLOC_STAT_ADD(
+            pool->stats.waste_page_tail, pmalloc_page_free(pool, open[0]));
+        // The page might be past where protecting stops, so make the next
+        // protection look at the whole list if it still has to be sealed or
+        // trimmed
+        if (open[0]->bp_offset < open[0]->ro_offset
+                || pool->flags & PMALLOC_POOL_TRIM) {
+            pool->sealed = NULL;
+        }
+        pmalloc_open_remove(pool, 0);
+    }
+    open[pool->open_count] = page;
+    pmalloc_open_sort(pool, pool->open_count++);
+}
+
+/** \brief Try to allocate from the open page with the least room that fits
+ *
+ * The caller must hold the pool's lock.
+ *
+ * \return Pointer to the allocated memory, or `NULL` if no open page has room
+ */
+static void *pmalloc_bump_open(
+    pmalloc_pool_t *pool,
+    size_t size,
+    size_t align,
+    size_t min_page_size
+) {
+    // The pages are sorted by free space, so the first that fits is the best
+    for (size_t i = 0; i < pool->open_count; i++) {
+        void *const ret =
+            pmalloc_bump_page(pool, pool->open[i], size, align, min_page_size);
+        if (ret != NULL) {
+            pmalloc_open_sort(pool, i);
+            return ret;
+        }
+    }
+    return NULL;
+}
+
+/** \brief Allocate from a pool while holding its lock
+ *
+ * This tries the head page first, then the open pages if the pool has
+ * `PMALLOC_POOL_BEST_FIT`, and maps a new page if that fails. Objects too big
+ * for a page get their own with pmalloc_align_large().
+ *
+ * \return Pointer to the allocated memory, or `NULL` if the object can't fit
+ *         in a page and `PMALLOC_MULTIPAGE_ALLOC` is unset, or if the pool is
+ *         shared and its arena is full
+ */
+static void *pmalloc_align_locked(
+    pmalloc_pool_t *pool,
+    size_t size,
+    size_t align
+) {
+    // Compute how much space is needed for allocation. If it can't fit in a
+    // normal page, we'll have to give it its own page.
+    const size_t min_page_size = pmalloc_min_page_size(pool, size, align);
+    if (pool->page_size < min_page_size) {
+        #if defined(PMALLOC_MULTIPAGE_ALLOC)
+            return pmalloc_align_large(pool, size, align, min_page_size);
+        #else
+            return NULL;
+        #endif
+    }
+
+    // Someone else might have linked in a new page while we were waiting for
+    // the lock. Try the head again before making our own.
+    void *const ret = pmalloc_bump_head(pool, size, align, min_page_size);
+    if (ret != NULL) {
+        return ret;
+    }
+
+    // Then try the other pages with room in them, if we're keeping track
+    const bool best_fit = pool->flags & PMALLOC_POOL_BEST_FIT;
+    if (best_fit) {
+        void *const ret = pmalloc_bump_open(pool, size, align, min_page_size);
+        if (ret != NULL) {
+            return ret;
+        }
+    }
+
+    // Get the new page. Use a spare one if we have it, since it's already
+    // mapped. Otherwise, allocate it. It might be bigger than we asked for.
+    pmalloc_page_header_t *new_page = pool->spare;
+    const bool fresh = new_page == NULL;
+    size_t new_page_size;
+    size_t new_seal_size = 0;
+    char *new_page_base;
+    if (!fresh) {
+        pool->spare = new_page->next;
+        new_page_size = new_page->page_size;
+        new_page_base = new_page->base;
+    } else {
+        new_page_size = pool->page_size;
+        new_page_base = pmalloc_new_page(pool, &new_page_size, &new_seal_size);
+        if (new_page_base == NULL) {
+            return NULL;
+        }
+        new_page = pmalloc_new_header(pool, new_page_base);
+    }
+    assert(new_page_size >= pool->page_size);
+    assert(new_page_size >= min_page_size);
+
+    // The head page is about to be replaced. Whatever is left in it goes to
+    // waste, unless we keep it open for later. Allocations racing with us might
+    // still claim space in it, but that only makes its free space smaller.
+    pmalloc_page_header_t *const head = pool->head;
+    if (head != NULL && !PMALLOC_ATOMIC_LOAD(&head->ro)) {
+        if (best_fit) {
+            pmalloc_open_insert(pool, head);
+        } else {
+            PMALLOC_STAT_ADD(
+                pool->stats.waste_page_tail, pmalloc_page_free(pool, head));
+        }
+    }
+
+    // Set up the fields
+    const size_t new_page_bp =
+        pmalloc_align_down(new_page_size - size, align);
+    assert(new_page_bp >= pool->header_size);
+    assert(new_page_bp % (1ll << align) == 0);
+    PMALLOC_STAT_ADD(
+        pool->stats.waste_alignment, new_page_size - size - new_page_bp);
+    // Spare pages are in the page map already, so pmalloc_is_protected() might
+    // be reading them. Their base and size stay the same.
+    if (fresh) {
+        new_page->base = new_page_base;
+        new_page->page_size = new_page_size;
+        new_page->seal_size = new_seal_size;
+    }
+    new_page->bp_offset = new_page_bp;
+    PMALLOC_ATOMIC_STORE(&new_page->ro_offset, new_page_size);
+    new_page->ro = false;
+    // Spare pages were already tracked when they were mapped
+    if (fresh) {
+        pmalloc_track_page(pool, new_page);
+    }
+    // Link it in. This publishes the page to the fast path, so it has to be
+    // done after all the fields are set.
+    new_page->next = head;
+    PMALLOC_ATOMIC_STORE(&pool->head, new_page);
+    // Return
+    return new_page_base + new_page_bp;
+}
+
+
+/** \brief Whether an allocation filled the head page past halfway
+ *
+ * Only the allocation that crosses the halfway point returns true, so that a
+ * pool with `PMALLOC_POOL_PREFAULT` refills its spare page once per page. The
+ * allocation at `ptr` claimed `size` bytes, plus less than `1 << align` bytes
+ * of padding above them.
+ */
+static bool pmalloc_crossed_mark(
+    pmalloc_pool_t *pool,
+    char *ptr,
+    size_t size,
+    size_t align
+) {
+    pmalloc_page_header_t *const head = PMALLOC_ATOMIC_LOAD(&pool->head);
+    if (head == NULL
+            || ptr < head->base || ptr >= head->base + head->page_size) {
+        return false;
+    }
+    const size_t mark = head->page_size / 2;
+    const size_t bp = ptr - head->base;
+    return bp < mark && bp + size + ((size_t) 1 << align) > mark;
+}
+
+/** \brief Map and fault in a spare page if the pool doesn't have one
+ *
+ * The page is faulted in without holding the pool's lock, so other threads can
+ * keep allocating from the head page meanwhile. The lock is only held to take
+ * the page from the arena and to link it in.
+ *
+ * \sa PMALLOC_POOL_PREFAULT
+ */
+static void pmalloc_refill_spare(pmalloc_pool_t *pool) {
+    // Pages from the arena have to be committed with the lock held. Other pages
+    // can be mapped without it.
+    const bool in_arena = pool->arena.base != NULL || pool->group != NULL;
+    #if defined(PMALLOC_THREADS)
+        pmalloc_lock_mutex(&pool->mutex);
+    #endif
+    const bool has_spare = pool->spare != NULL;
+    size_t page_size = pool->page_size;
+    size_t seal_size;
+    char *base = NULL;
+    if (!has_spare && in_arena) {
+        base = pmalloc_new_page(pool, &page_size, &seal_size);
+    }
+    #if defined(PMALLOC_THREADS)
+        pmalloc_unlock_mutex(&pool->mutex);
+    #endif
+    if (has_spare) {
+        return;
+    }
+    if (!in_arena) {
+        base = pmalloc_new_page(pool, &page_size, &seal_size);
+    }
+    if (base == NULL) {
+        return;
+    }
+    pmalloc_prefault_page(base, page_size);
+
+    // Link it in. Another thread might have added a spare page meanwhile, but
+    // then this one just waits for the next page after that.
+    #if defined(PMALLOC_THREADS)
+        pmalloc_lock_mutex(&pool->mutex);
+    #endif
+    pmalloc_page_header_t *const page = pmalloc_new_header(pool, base);
+    page->base = base;
+    page->page_size = page_size;
+    page->seal_size = seal_size;
+    pmalloc_spare_page(pool, page);
+    pmalloc_track_page(pool, page);
+    #if defined(PMALLOC_THREADS)
+        pmalloc_unlock_mutex(&pool->mutex);
+    #endif
+}
+
 
 PMALLOC_API pmalloc_pool_t *pmalloc_create_custom_pool(size_t page_size) {
+    pmalloc_pool_attr_t attr;
+    pmalloc_pool_attr_init(&attr);
+    attr.page_size = page_size;
+    return pmalloc_create_attr_pool(&attr);
+}
+
+/** \brief Create a pool, backing its arena with `fd` if it needs a file
+ *
+ * This is pmalloc_create_attr_pool(), except that the file can be given. The
+ * pool takes ownership of it.
+ *
+ * \param fd The file to back the arena with, or `-1` to make one if needed
+ */
+static pmalloc_pool_t *pmalloc_create_fd_pool(
+    const pmalloc_pool_attr_t *attr,
+    int fd
+) {
     // Error checking the arguments. The page size cannot be zero - it just
     // doesn't make sense.
-    assert(page_size != 0);
-    if (page_size == 0) {
+    assert(attr);
+    if (attr == NULL) {
+        return NULL;
+    }
+    assert(attr->page_size != 0);
+    if (attr->page_size == 0) {
+        return NULL;
+    }
+    // An arena has to have room for at least one page. Write-rare pools need
+    // one for the second mapping, and shared pools need one so other
+    // processes can map all the pages at once.
+    #if defined(PMALLOC_MEMFD)
+        const bool has_fd =
+            attr->flags & (PMALLOC_POOL_WRITE_RARE | PMALLOC_POOL_SHARED);
+    #else
+        const bool has_fd = false;
+    #endif
+    const bool has_arena = has_fd || (attr->flags & PMALLOC_POOL_ARENA);
+    assert(!has_arena || attr->arena_size >= attr->page_size);
+    if (has_arena && attr->arena_size < attr->page_size) {
+        return NULL;
+    }
+    // Pages can only be bound to nodes the kernel's masks can describe
+    assert(attr->numa_policy <= PMALLOC_NUMA_INTERLEAVE);
+    if (attr->numa_policy > PMALLOC_NUMA_INTERLEAVE) {
+        return NULL;
+    }
+    const bool bad_node =
+        attr->numa_node < 0 || attr->numa_node >= PMALLOC_NUMA_MAXNODES;
+    assert(attr->numa_policy != PMALLOC_NUMA_BIND || !bad_node);
+    if (attr->numa_policy == PMALLOC_NUMA_BIND && bad_node) {
         return NULL;
     }
     // Allocate and return
+    static size_t next_id = 0;
     pmalloc_pool_t *const ret = pmalloc_alloc_pool();
     ret->head = NULL;
-    ret->page_size = page_size;
+    ret->page_size = attr->page_size;
+    ret->flags = attr->flags;
+    ret->header_size = (attr->flags & PMALLOC_POOL_EXTERNAL_HEADERS)
+        ? 0
+        : sizeof(pmalloc_page_header_t);
+    ret->headers = NULL;
+    ret->open_count = 0;
+    ret->sealed = NULL;
+    ret->large = NULL;
+    ret->spare = NULL;
+    ret->id = PMALLOC_ATOMIC_ADD(&next_id, 1);
+    ret->epoch = 0;
+    ret->generation = 0;
+    ret->arena.base = NULL;
+    ret->arena.size = attr->arena_size;
+    ret->arena.committed = 0;
+    ret->numa_policy = attr->numa_policy;
+    ret->numa_node = attr->numa_node;
+    ret->group = NULL;
+    ret->group_next = NULL;
+    if (has_arena) {
+        ret->arena.base = pmalloc_reserve_page(&ret->arena.size);
+    }
+    #if defined(PMALLOC_MEMFD)
+        if (has_fd && fd == -1) {
+            fd = pmalloc_create_fd();
+        }
+        ret->arena.fd = fd;
+        ret->arena.alias = NULL;
+        if (attr->flags & PMALLOC_POOL_WRITE_RARE) {
+            size_t alias_size = ret->arena.size;
+            ret->arena.alias = pmalloc_reserve_page(&alias_size);
+            assert(alias_size == ret->arena.size);
+        }
+        // Shared pools start with a description of themselves, so other
+        // processes can find them
+        if (attr->flags & PMALLOC_POOL_SHARED) {
+            size_t superblock_size = sizeof(pmalloc_superblock_t);
+            pmalloc_superblock_t *const superblock =
+                pmalloc_commit_arena(&ret->arena, &superblock_size);
+            superblock->magic = PMALLOC_SUPERBLOCK_MAGIC;
+            superblock->base = ret->arena.base;
+            superblock->size = ret->arena.size;
+            superblock->root = 0;
+        }
+    #else
+        (void) has_fd;
+        (void) fd;
+    #endif
+    #if defined(PMALLOC_STATS)
+        ret->stats = (pmalloc_stats_t) {0};
+    #endif
+    PMALLOC_STAT_ADD(pmalloc_global_counters.pools, 1);
     #if defined(PMALLOC_THREADS)
         pmalloc_alloc_mutex(&ret->mutex);
     #endif
     return ret;
 }
 
-PMALLOC_API void pmalloc_destroy_pool(pmalloc_pool_t *pool) {
-    // Error checking the arguments. Behave like `free` and don't do anything if
-    // passed a `NULL` pool.
+PMALLOC_API pmalloc_pool_t *pmalloc_create_attr_pool(
+    const pmalloc_pool_attr_t *attr
+) {
+    return pmalloc_create_fd_pool(attr, -1);
+}
+
+PMALLOC_API void pmalloc_destroy_pool(pmalloc_pool_t *pool) {
+    // Error checking the arguments. Behave like `free` and don't do anything if
+    // passed a `NULL` pool.
+    assert(pool);
+    if (pool == NULL) {
+        return;
+    }
+    // We don't have to lock here. It's undefined behavior to have a race with
+    // this and any other function call. The group can still be protected
+    // meanwhile, though, so take this pool out of it first.
+    pmalloc_group_t *const group = pool->group;
+    if (group != NULL) {
+        #if defined(PMALLOC_THREADS)
+            pmalloc_lock_mutex(&group->members_mutex);
+        #endif
+        pmalloc_pool_t **link = &group->members;
+        while (*link != pool) {
+            link = &(*link)->group_next;
+        }
+        *link = pool->group_next;
+        #if defined(PMALLOC_THREADS)
+            pmalloc_unlock_mutex(&group->members_mutex);
+        #endif
+    }
+
+    // Traverse the linked list, freeing all the pages. Make sure we don't read
+    // from the pointer once it's destroyed.
+    pmalloc_page_header_t *cur = pool->head;
+    while (cur != NULL) {
+        pmalloc_page_header_t *next = cur->next;
+        pmalloc_delete_page(pool, cur);
+        cur = next;
+    }
+    // Same for the spare pages
+    cur = pool->spare;
+    while (cur != NULL) {
+        pmalloc_page_header_t *next = cur->next;
+        pmalloc_delete_page(pool, cur);
+        cur = next;
+    }
+    // Same for the large pages. Their headers are freed separately if they
+    // aren't in the page.
+    cur = pool->large;
+    while (cur != NULL) {
+        pmalloc_page_header_t *next = cur->next;
+        pmalloc_delete_large(pool, cur);
+        cur = next;
+    }
+    // Free all the pages in the arena at once
+    if (pool->arena.base != NULL) {
+        pmalloc_release_page(pool->arena.base, pool->arena.size);
+    }
+    #if defined(PMALLOC_MEMFD)
+        if (pool->arena.alias != NULL) {
+            pmalloc_release_page(pool->arena.alias, pool->arena.size);
+        }
+        if (pool->arena.fd != -1) {
+            pmalloc_close_fd(pool->arena.fd);
+        }
+    #endif
+    // Free the headers now that nothing reads them
+    pmalloc_header_table_t *table = pool->headers;
+    while (table != NULL) {
+        pmalloc_header_table_t *next = table->next;
+        pmalloc_free_heap(table);
+        table = next;
+    }
+
+    PMALLOC_STAT_SUB(pmalloc_global_counters.pools, 1);
+
+    // Destroy the pool and the lock inside it
+    #if defined(PMALLOC_THREADS)
+        pmalloc_free_mutex(&pool->mutex);
+    #endif
+    pmalloc_free_pool(pool);
+}
+
+/** \brief Seal everything in a pool while holding its lock
+ *
+ * The ranges are added to `run`, and the last one might still be there. The
+ * caller has to flush it.
+ *
+ * \param [inout] run Sealed ranges to coalesce with
+ */
+static void pmalloc_protect_locked(
+    pmalloc_pool_t *pool,
+    pmalloc_range_t *run
+) {
+    // Tell threads that their cached chunks are about to become read only.
+    // This has to happen first, so any thread that allocates after we return
+    // sees it.
+    PMALLOC_ATOMIC_ADD(&pool->epoch, 1);
+    pool->generation++;
+    PMALLOC_STAT_ADD(pool->stats.protects, 1);
+
+    // Traverse the linked list, sealing all the pages. Stop once we get to the
+    // pages that were retired before the last protection, since they've been
+    // sealed already. Pages that are next to each other in memory are sealed
+    // together, which is always the case for pages in an arena.
+    const bool trim = pool->flags & PMALLOC_POOL_TRIM;
+    pmalloc_page_header_t *cur = pool->head;
+    while (cur != pool->sealed) {
+        assert(cur != NULL);
+        if (!cur->ro) {
+            pmalloc_seal_page(pool, cur, run);
+        }
+        if (trim && pmalloc_page_is_dead(pool, cur)) {
+            pmalloc_trim_page(pool, cur);
+        }
+        cur = cur->next;
+    }
+    // Every page but the head is retired now. Open pages are sealed below
+    // every time, and they reset this if they're retired unsealed.
+    pool->sealed = pool->head != NULL ? pool->head->next : NULL;
+    // Large pages are sealed whole, since nothing else will ever be allocated
+    // in them. Again, stop at the first one that's already read only. Pages
+    // pushed while we're doing this might not be sealed, which is fine since
+    // their allocations are concurrent with this call.
+    cur = PMALLOC_ATOMIC_LOAD(&pool->large);
+    while (cur != NULL && !cur->ro) {
+        cur->ro = true;
+        pmalloc_seal_range(run, cur->base, cur->base + cur->ro_offset);
+        PMALLOC_ATOMIC_STORE(&cur->ro_offset, 0);
+        if (trim) {
+            pmalloc_trim_page(pool, cur);
+        }
+        cur = cur->next;
+    }
+
+    // Open pages might come after where the walk stopped, so they have to be
+    // sealed separately. Pages with nothing left to allocate from are dropped.
+    for (size_t i = 0; i < pool->open_count;) {
+        pmalloc_page_header_t *const page = pool->open[i];
+        if (!page->ro) {
+            pmalloc_seal_page(pool, page, run);
+        }
+        if (page->ro || pmalloc_page_free(pool, page) == 0) {
+            pmalloc_open_remove(pool, i);
+            if (trim) {
+                pmalloc_trim_page(pool, page);
+            }
+        } else {
+            pmalloc_open_sort(pool, i);
+            i++;
+        }
+    }
+}
+
+PMALLOC_API void pmalloc_protect_pool(pmalloc_pool_t *pool) {
+    // Error checking the arguments. Don't do anything if the argument is
+    // `NULL`.
+    assert(pool);
+    if (pool == NULL) {
+        return;
+    }
+    // Lock
+    #if defined(PMALLOC_THREADS)
+        pmalloc_lock_mutex(&pool->mutex);
+    #endif
+
+    pmalloc_range_t run = {NULL, NULL, 0, pmalloc_markro_page, NULL};
+    pmalloc_protect_locked(pool, &run);
+    pmalloc_flush_range(&run);
+    PMALLOC_STAT_ADD(pool->stats.protect_calls, run.calls);
+
+    // Unlock
+    #if defined(PMALLOC_THREADS)
+        pmalloc_unlock_mutex(&pool->mutex);
+    #endif
+}
+
+PMALLOC_API size_t pmalloc_trim_pool(pmalloc_pool_t *pool) {
+    // Error checking the arguments
+    assert(pool);
+    if (pool == NULL) {
+        return 0;
+    }
+    // Lock
+    #if defined(PMALLOC_THREADS)
+        pmalloc_lock_mutex(&pool->mutex);
+    #endif
+
+    // Look at every page, not just the ones since the last protection. Pages
+    // already trimmed have nothing left to release.
+    size_t ret = 0;
+    for (pmalloc_page_header_t *cur = pool->head; cur != NULL;
+            cur = cur->next) {
+        if (pmalloc_page_is_dead(pool, cur)) {
+            ret += pmalloc_trim_page(pool, cur);
+        }
+    }
+    // Large pages only ever hold one object
+    for (pmalloc_page_header_t *cur = PMALLOC_ATOMIC_LOAD(&pool->large);
+            cur != NULL; cur = cur->next) {
+        ret += pmalloc_trim_page(pool, cur);
+    }
+
+    // Unlock
+    #if defined(PMALLOC_THREADS)
+        pmalloc_unlock_mutex(&pool->mutex);
+    #endif
+    return ret;
+}
+
+PMALLOC_API void pmalloc_reset_pool(pmalloc_pool_t *pool) {
+    // Error checking the arguments. Don't do anything if the argument is
+    // `NULL`.
+    assert(pool);
+    if (pool == NULL) {
+        return;
+    }
+    // Lock. Allocations can't race with this, but other calls that take the
+    // lock still can.
+    #if defined(PMALLOC_THREADS)
+        pmalloc_lock_mutex(&pool->mutex);
+    #endif
+
+    // Throw out the chunks threads have cached, and any marks
+    PMALLOC_ATOMIC_ADD(&pool->epoch, 1);
+    pool->generation++;
+
+    // Make the sealed parts of the pages writable first, since the headers
+    // might be in them. Open pages are all in the list, so they're covered.
+    pmalloc_range_t run = {NULL, NULL, 0, pmalloc_markrw_page, NULL};
+    pmalloc_page_header_t *cur = pool->head;
+    while (cur != NULL) {
+        pmalloc_seal_range(
+            &run, cur->base + cur->ro_offset, cur->base + cur->page_size);
+        cur = cur->next;
+    }
+    pmalloc_flush_range(&run);
+    PMALLOC_STAT_ADD(pool->stats.protect_calls, run.calls);
+
+    // Now every page can be reused from the start. The next allocation will
+    // take one as the head.
+    cur = pool->head;
+    while (cur != NULL) {
+        pmalloc_page_header_t *next = cur->next;
+        pmalloc_spare_page(pool, cur);
+        cur = next;
+    }
+    PMALLOC_ATOMIC_STORE(&pool->head, NULL);
+    pool->open_count = 0;
+    pool->sealed = NULL;
+    // Large pages are only any good for the object they were made for
+    cur = pool->large;
+    while (cur != NULL) {
+        pmalloc_page_header_t *next = cur->next;
+        PMALLOC_STAT_SUB(pool->stats.pages, 1);
+        PMALLOC_STAT_SUB(pool->stats.page_bytes, cur->page_size);
+        pmalloc_delete_large(pool, cur);
+        cur = next;
+    }
+    PMALLOC_ATOMIC_STORE(&pool->large, NULL);
+
+    // Unlock
+    #if defined(PMALLOC_THREADS)
+        pmalloc_unlock_mutex(&pool->mutex);
+    #endif
+}
+
+PMALLOC_API pmalloc_mark_t pmalloc_mark(pmalloc_pool_t *pool) {
+    // Error checking the arguments
+    assert(pool);
+    if (pool == NULL) {
+        return (pmalloc_mark_t) {0};
+    }
+
+    // The head page's boundary pointer has to be read with the lock held, so
+    // that it matches the head page
+    #if defined(PMALLOC_THREADS)
+        pmalloc_lock_mutex(&pool->mutex);
+    #endif
+    pmalloc_page_header_t *const head = pool->head;
+    const pmalloc_mark_t ret = {
+        .page = head,
+        .offset = head != NULL ? PMALLOC_ATOMIC_LOAD(&head->bp_offset) : 0,
+        .large = PMALLOC_ATOMIC_LOAD(&pool->large),
+        .generation = pool->generation,
+    };
+    #if defined(PMALLOC_THREADS)
+        pmalloc_unlock_mutex(&pool->mutex);
+    #endif
+    return ret;
+}
+
+PMALLOC_API bool pmalloc_rewind(pmalloc_pool_t *pool, pmalloc_mark_t mark) {
+    // Error checking the arguments
     assert(pool);
     if (pool == NULL) {
-        return;
+        return false;
     }
-    // We don't have to lock here. It's undefined behavior to have a race with
-    // this and any other function call.
+    // Lock
+    #if defined(PMALLOC_THREADS)
+        pmalloc_lock_mutex(&pool->mutex);
+    #endif
 
-    // Traverse the linked list, freeing all the pages. Make sure we don't read
-    // from the pointer once it's destroyed.
-    pmalloc_page_header_t *cur = pool->head;
-    while (cur != NULL) {
-        pmalloc_page_header_t *next = cur->next;
-        pmalloc_free_page(cur, cur->page_size);
-        cur = next;
+    // Nothing since the mark can have been sealed, so we don't have to make
+    // anything writable
+    const bool valid = mark.generation == pool->generation;
+    if (valid) {
+        // Throw out the chunks threads have cached, since they might be after
+        // the mark
+        PMALLOC_ATOMIC_ADD(&pool->epoch, 1);
+
+        // Pages linked in after the mark are empty again. They're all newer
+        // than where the last protection stopped.
+        pmalloc_page_header_t *cur = pool->head;
+        while (cur != mark.page) {
+            assert(cur != NULL && cur != pool->sealed);
+            pmalloc_page_header_t *next = cur->next;
+            pmalloc_spare_page(pool, cur);
+            cur = next;
+        }
+        // The page that was the head gets its space back and becomes the head
+        // again. It might have been made an open page in the meantime.
+        pmalloc_page_header_t *const page = mark.page;
+        if (page != NULL) {
+            PMALLOC_ATOMIC_STORE(&page->bp_offset, mark.offset);
+        }
+        PMALLOC_ATOMIC_STORE(&pool->head, page);
+        // Drop the open pages that are now spare or the head. Spare pages are
+        // the only ones with nothing allocated in them.
+        for (size_t i = 0; i < pool->open_count;) {
+            pmalloc_page_header_t *const open = pool->open[i];
+            if (open == page || open->bp_offset == open->page_size) {
+                pmalloc_open_remove(pool, i);
+            } else {
+                i++;
+            }
+        }
+
+        // Large pages pushed after the mark are freed
+        cur = pool->large;
+        while (cur != mark.large) {
+            assert(cur != NULL);
+            pmalloc_page_header_t *next = cur->next;
+            PMALLOC_STAT_SUB(pool->stats.pages, 1);
+            PMALLOC_STAT_SUB(pool->stats.page_bytes, cur->page_size);
+            pmalloc_delete_large(pool, cur);
+            cur = next;
+        }
+        PMALLOC_ATOMIC_STORE(&pool->large, mark.large);
     }
 
-    // Destroy the pool and the lock inside it
+    // Unlock
     #if defined(PMALLOC_THREADS)
-        pmalloc_free_mutex(&pool->mutex);
+        pmalloc_unlock_mutex(&pool->mutex);
     #endif
-    pmalloc_free_pool(pool);
+    return valid;
 }
 
-PMALLOC_API void pmalloc_protect_pool(pmalloc_pool_t *pool) {
-    // Error checking the arguments. Don't do anything if the argument is
-    // `NULL`.
+#if defined(PMALLOC_MEMFD)
+/** \brief Map a shared pool's file read only and make a pool to hold it
+ *
+ * The pool doesn't own the file. It can't allocate, since its arena looks full
+ * and shared pools can't take pages from anywhere else.
+ *
+ * \param same_address Whether the file has to be mapped at the address it
+ *                     has in the process that made it
+ * \return The pool, or `NULL` if `fd` isn't a shared pool or couldn't be
+ *         mapped
+ */
+static pmalloc_pool_t *pmalloc_attach_fd_pool(int fd, bool same_address) {
+    pmalloc_superblock_t superblock;
+    if (!pmalloc_read_fd(fd, &superblock, sizeof(superblock))
+            || superblock.magic != PMALLOC_SUPERBLOCK_MAGIC) {
+        return NULL;
+    }
+    char *const base = pmalloc_attach_fd_page(
+        same_address ? superblock.base : NULL, superblock.size, fd);
+    if (base == NULL) {
+        return NULL;
+    }
+
+    pmalloc_pool_attr_t attr;
+    pmalloc_pool_attr_init(&attr);
+    pmalloc_pool_t *const ret = pmalloc_create_attr_pool(&attr);
+    ret->flags = PMALLOC_POOL_ARENA | PMALLOC_POOL_SHARED;
+    ret->arena.base = base;
+    ret->arena.size = superblock.size;
+    ret->arena.committed = superblock.size;
+    return ret;
+}
+
+PMALLOC_API int pmalloc_pool_fd(pmalloc_pool_t *pool) {
     assert(pool);
     if (pool == NULL) {
+        return -1;
+    }
+    return pool->arena.fd;
+}
+
+PMALLOC_API pmalloc_pool_t *pmalloc_attach_pool(int fd) {
+    // Error checking the arguments. Make sure the file is a shared pool.
+    assert(fd >= 0);
+    if (fd < 0) {
+        return NULL;
+    }
+    return pmalloc_attach_fd_pool(fd, true);
+}
+
+PMALLOC_API pmalloc_pool_t *pmalloc_create_file_pool(
+    const char *path,
+    const pmalloc_pool_attr_t *attr
+) {
+    // Error checking the arguments
+    assert(path);
+    assert(attr);
+    if (path == NULL || attr == NULL) {
+        return NULL;
+    }
+    const int fd = pmalloc_open_fd(path, true);
+    if (fd == -1) {
+        return NULL;
+    }
+    // All the pages have to be in the file
+    pmalloc_pool_attr_t shared_attr = *attr;
+    shared_attr.flags |= PMALLOC_POOL_SHARED;
+    pmalloc_pool_t *const ret = pmalloc_create_fd_pool(&shared_attr, fd);
+    if (ret == NULL) {
+        pmalloc_close_fd(fd);
+    }
+    return ret;
+}
+
+PMALLOC_API pmalloc_pool_t *pmalloc_open_file_pool(const char *path) {
+    // Error checking the arguments
+    assert(path);
+    if (path == NULL) {
+        return NULL;
+    }
+    const int fd = pmalloc_open_fd(path, false);
+    if (fd == -1) {
+        return NULL;
+    }
+    // The mapping keeps the file's contents around, so we don't need it
+    pmalloc_pool_t *const ret = pmalloc_attach_fd_pool(fd, false);
+    pmalloc_close_fd(fd);
+    return ret;
+}
+
+PMALLOC_API void pmalloc_flush_pool(pmalloc_pool_t *pool) {
+    // Error checking the arguments. Only pools in files can be flushed.
+    assert(pool);
+    assert(pool && pmalloc_is_shared(pool) && pool->arena.fd != -1);
+    if (pool == NULL || !pmalloc_is_shared(pool) || pool->arena.fd == -1) {
         return;
     }
-    // Lock
+    // Lock, so no pages are committed while we're doing this
     #if defined(PMALLOC_THREADS)
         pmalloc_lock_mutex(&pool->mutex);
     #endif
+    pmalloc_sync_page(pool->arena.base, pool->arena.committed);
+    #if defined(PMALLOC_THREADS)
+        pmalloc_unlock_mutex(&pool->mutex);
+    #endif
+}
 
-    // Traverse the linked list, marking all the pages. Stop once we see the
-    // first read-only page, as everything after that is read-only. Make sure we
-    // don't write to a page once it's marked.
-    pmalloc_page_header_t *cur = pool->head;
-    while (cur != NULL && !cur->ro) {
-        cur->ro = true;
-        pmalloc_markro_page(cur, cur->page_size);
-        cur = cur->next;
+PMALLOC_API void pmalloc_set_root(pmalloc_pool_t *pool, void *root) {
+    // Error checking the arguments. Only the process that made the pool can
+    // write to it.
+    assert(pool);
+    assert(pool && pmalloc_is_shared(pool) && pool->arena.fd != -1);
+    if (pool == NULL || !pmalloc_is_shared(pool) || pool->arena.fd == -1) {
+        return;
+    }
+    assert(root == NULL || pmalloc_in_arena(&pool->arena, root));
+    pmalloc_superblock_t *const superblock =
+        (pmalloc_superblock_t *) pool->arena.base;
+    PMALLOC_ATOMIC_STORE(
+        &superblock->root,
+        root != NULL ? (size_t) ((char *) root - pool->arena.base) : 0);
+}
+
+PMALLOC_API void *pmalloc_get_root(pmalloc_pool_t *pool) {
+    // Error checking the arguments
+    assert(pool);
+    assert(pool && pmalloc_is_shared(pool));
+    if (pool == NULL || !pmalloc_is_shared(pool)) {
+        return NULL;
+    }
+    pmalloc_superblock_t *const superblock =
+        (pmalloc_superblock_t *) pool->arena.base;
+    const size_t root = PMALLOC_ATOMIC_LOAD(&superblock->root);
+    return root != 0 ? pool->arena.base + root : NULL;
+}
+#endif
+
+PMALLOC_API pmalloc_replicas_t *pmalloc_create_replicas(
+    const pmalloc_pool_attr_t *attr,
+    void *(*build)(pmalloc_pool_t *pool, void *arg),
+    void *arg
+) {
+    // Error checking the arguments
+    assert(attr);
+    assert(build);
+    if (attr == NULL || build == NULL) {
+        return NULL;
+    }
+    #if defined(PMALLOC_NUMA)
+        const uint64_t nodes = pmalloc_numa_nodes();
+    #else
+        const uint64_t nodes = 1;
+    #endif
+
+    pmalloc_replicas_t *const ret =
+        pmalloc_alloc_heap(sizeof(pmalloc_replicas_t));
+    for (int i = 0; i < PMALLOC_NUMA_MAXNODES; i++) {
+        ret->pools[i] = NULL;
+    }
+    int first = -1;
+    for (int i = 0; i < PMALLOC_NUMA_MAXNODES; i++) {
+        if (!(nodes & ((uint64_t) 1 << i))) {
+            continue;
+        }
+        // Build this node's copy with all its pages bound there
+        pmalloc_pool_attr_t node_attr = *attr;
+        #if defined(PMALLOC_NUMA)
+            node_attr.numa_policy = PMALLOC_NUMA_BIND;
+            node_attr.numa_node = i;
+        #endif
+        pmalloc_pool_t *const pool = pmalloc_create_attr_pool(&node_attr);
+        void *const root = pool != NULL ? build(pool, arg) : NULL;
+        if (root == NULL) {
+            if (pool != NULL) {
+                pmalloc_destroy_pool(pool);
+            }
+            pmalloc_destroy_replicas(ret);
+            return NULL;
+        }
+        pmalloc_protect_pool(pool);
+        ret->pools[i] = pool;
+        ret->roots[i] = root;
+        if (first == -1) {
+            first = i;
+        }
+    }
+    // Nodes without memory use the first copy
+    assert(first != -1);
+    for (int i = 0; i < PMALLOC_NUMA_MAXNODES; i++) {
+        if (ret->pools[i] == NULL) {
+            ret->roots[i] = ret->roots[first];
+        }
+    }
+    return ret;
+}
+
+PMALLOC_API void *pmalloc_local_replica(const pmalloc_replicas_t *replicas) {
+    assert(replicas);
+    #if defined(PMALLOC_NUMA)
+        return replicas->roots[pmalloc_numa_node()];
+    #else
+        return replicas->roots[0];
+    #endif
+}
+
+PMALLOC_API void pmalloc_destroy_replicas(pmalloc_replicas_t *replicas) {
+    // Behave like `free` on `NULL`
+    assert(replicas);
+    if (replicas == NULL) {
+        return;
+    }
+    for (int i = 0; i < PMALLOC_NUMA_MAXNODES; i++) {
+        if (replicas->pools[i] != NULL) {
+            pmalloc_destroy_pool(replicas->pools[i]);
+        }
+    }
+    pmalloc_free_heap(replicas);
+}
+
+PMALLOC_API pmalloc_group_t *pmalloc_create_group(size_t arena_size) {
+    if (arena_size == 0) {
+        arena_size = PMALLOC_DEFAULT_ARENASIZE;
+    }
+    pmalloc_group_t *const ret = pmalloc_alloc_heap(sizeof(pmalloc_group_t));
+    ret->arena.size = arena_size;
+    ret->arena.base = pmalloc_reserve_page(&ret->arena.size);
+    ret->arena.committed = 0;
+    #if defined(PMALLOC_MEMFD)
+        ret->arena.fd = -1;
+        ret->arena.alias = NULL;
+    #endif
+    ret->members = NULL;
+    #if defined(PMALLOC_THREADS)
+        pmalloc_alloc_mutex(&ret->members_mutex);
+        pmalloc_alloc_mutex(&ret->arena_mutex);
+    #endif
+    return ret;
+}
+
+PMALLOC_API pmalloc_pool_t *pmalloc_create_group_pool(
+    pmalloc_group_t *group,
+    const pmalloc_pool_attr_t *attr
+) {
+    // Error checking the arguments. Pools with their own file can't take pages
+    // from the group's anonymous arena.
+    assert(group);
+    assert(attr);
+    if (group == NULL || attr == NULL) {
+        return NULL;
+    }
+    #if defined(PMALLOC_MEMFD)
+        const unsigned own_file = PMALLOC_POOL_WRITE_RARE | PMALLOC_POOL_SHARED;
+        assert(!(attr->flags & own_file));
+        if (attr->flags & own_file) {
+            return NULL;
+        }
+    #endif
+    pmalloc_pool_attr_t member_attr = *attr;
+    member_attr.flags &= ~PMALLOC_POOL_ARENA;
+    pmalloc_pool_t *const ret = pmalloc_create_attr_pool(&member_attr);
+    if (ret == NULL) {
+        return NULL;
+    }
+
+    // Nothing else can see the pool yet, so its group can be set without its
+    // lock
+    ret->group = group;
+    #if defined(PMALLOC_THREADS)
+        pmalloc_lock_mutex(&group->members_mutex);
+    #endif
+    ret->group_next = group->members;
+    group->members = ret;
+    #if defined(PMALLOC_THREADS)
+        pmalloc_unlock_mutex(&group->members_mutex);
+    #endif
+    return ret;
+}
+
+/** \brief Order spans by where they start, for `qsort` */
+static int pmalloc_span_compare(const void *a, const void *b) {
+    const char *const a_start = ((const pmalloc_span_t *) a)->start;
+    const char *const b_start = ((const pmalloc_span_t *) b)->start;
+    return (a_start > b_start) - (a_start < b_start);
+}
+
+PMALLOC_API void pmalloc_protect_group(pmalloc_group_t *group) {
+    // Error checking the arguments
+    assert(group);
+    if (group == NULL) {
+        return;
+    }
+    // Lock the member list, then every member. Members only take the arena's
+    // lock while holding their own, so this can't deadlock with them.
+    #if defined(PMALLOC_THREADS)
+        pmalloc_lock_mutex(&group->members_mutex);
+        for (pmalloc_pool_t *cur = group->members; cur != NULL;
+                cur = cur->group_next) {
+            pmalloc_lock_mutex(&cur->mutex);
+        }
+    #endif
+
+    // Collect the ranges to seal from every member. Each member's own ranges
+    // are coalesced as usual.
+    pmalloc_span_list_t list = {NULL, 0, 0};
+    pmalloc_range_t run = {NULL, NULL, 0, pmalloc_markro_page, &list};
+    for (pmalloc_pool_t *cur = group->members; cur != NULL;
+            cur = cur->group_next) {
+        pmalloc_protect_locked(cur, &run);
+        pmalloc_flush_range(&run);
+    }
+    // Now sort them so that ranges next to each other can be sealed together,
+    // whichever pools they're from
+    if (list.count != 0) {
+        qsort(list.spans, list.count, sizeof(pmalloc_span_t),
+            pmalloc_span_compare);
+        run.save = NULL;
+        for (size_t i = 0; i < list.count; i++) {
+            pmalloc_seal_range(&run, list.spans[i].start, list.spans[i].end);
+        }
+        pmalloc_flush_range(&run);
+        pmalloc_free_heap(list.spans);
     }
 
     // Unlock
+    #if defined(PMALLOC_THREADS)
+        for (pmalloc_pool_t *cur = group->members; cur != NULL;
+                cur = cur->group_next) {
+            pmalloc_unlock_mutex(&cur->mutex);
+        }
+        pmalloc_unlock_mutex(&group->members_mutex);
+    #endif
+}
+
+PMALLOC_API void pmalloc_destroy_group(pmalloc_group_t *group) {
+    // Behave like `free` on `NULL`
+    assert(group);
+    if (group == NULL) {
+        return;
+    }
+    // Each pool takes itself out of the list when it's destroyed
+    while (group->members != NULL) {
+        pmalloc_destroy_pool(group->members);
+    }
+    // Free all the members' pages at once
+    pmalloc_release_page(group->arena.base, group->arena.size);
+    #if defined(PMALLOC_THREADS)
+        pmalloc_free_mutex(&group->members_mutex);
+        pmalloc_free_mutex(&group->arena_mutex);
+    #endif
+    pmalloc_free_heap(group);
+}
+
+/** \brief Find the page of a pool that holds `ptr`
+ *
+ * This looks through all the pages in the pool. The caller must hold the
+ * pool's lock.
+ *
+ * \return The page, or `NULL` if `ptr` isn't in the pool
+ */
+static pmalloc_page_header_t *pmalloc_find_page(
+    pmalloc_pool_t *pool,
+    const char *ptr
+) {
+    pmalloc_page_header_t *const lists[] = {
+        pool->head,
+        PMALLOC_ATOMIC_LOAD(&pool->large),
+    };
+    for (size_t i = 0; i < sizeof(lists) / sizeof(lists[0]); i++) {
+        for (pmalloc_page_header_t *cur = lists[i]; cur; cur = cur->next) {
+            if (ptr >= cur->base && ptr < cur->base + cur->page_size) {
+                return cur;
+            }
+        }
+    }
+    return NULL;
+}
+
+/** \brief Do pmalloc_rare_write() while holding the pool's lock */
+static bool pmalloc_rare_write_locked(
+    pmalloc_pool_t *pool,
+    char *dst,
+    const void *src,
+    size_t len
+) {
+    char *const end = dst + len;
+
+    // The write has to be inside one page
+    pmalloc_page_header_t *const page = pmalloc_find_page(pool, dst);
+    if (page == NULL || end > page->base + page->page_size) {
+        return false;
+    }
+
+    // If the destination has a writable alias, just copy through it
+    #if defined(PMALLOC_MEMFD)
+        pmalloc_arena_t *const arena = &pool->arena;
+        if (arena->alias != NULL && pmalloc_in_arena(arena, dst)) {
+            memcpy(arena->alias + (dst - arena->base), src, len);
+            return true;
+        }
+    #endif
+
+    // Otherwise, make the sealed part writable for a moment. Only the end of a
+    // page is ever sealed, and only in whole units of its seal size.
+    char *const sealed = page->base + page->ro_offset;
+    if (end <= sealed) {
+        memcpy(dst, src, len);
+        return true;
+    }
+    const size_t seal_size = page->seal_size;
+    char *const lo = page->base + pmalloc_round_down(
+        (size_t) ((dst > sealed ? dst : sealed) - page->base), seal_size);
+    char *const hi = page->base + pmalloc_round_up(
+        (size_t) (end - page->base), seal_size);
+    if (!pmalloc_write_begin(lo, hi - lo)) {
+        return false;
+    }
+    memcpy(dst, src, len);
+    // Same as failing to seal in the first place
+    if (!pmalloc_write_end(lo, hi - lo)) {
+        abort();
+    }
+    return true;
+}
+
+PMALLOC_API bool pmalloc_rare_write(
+    pmalloc_pool_t *pool,
+    void *dst,
+    const void *src,
+    size_t len
+) {
+    // Error checking the arguments. Writing nothing always works.
+    assert(pool);
+    assert(dst);
+    assert(len == 0 || src);
+    if (pool == NULL || dst == NULL || (len != 0 && src == NULL)) {
+        return false;
+    }
+    if (len == 0) {
+        return true;
+    }
+
+    // Lock, so the pages and their protection don't change under us
+    #if defined(PMALLOC_THREADS)
+        pmalloc_lock_mutex(&pool->mutex);
+    #endif
+    const bool ret = pmalloc_rare_write_locked(pool, dst, src, len);
     #if defined(PMALLOC_THREADS)
         pmalloc_unlock_mutex(&pool->mutex);
     #endif
+    return ret;
 }
 
 PMALLOC_API void *pmalloc_align(
@@ -91,79 +1858,215 @@ PMALLOC_API void *pmalloc_align(
     if (size == 0) {
         return NULL;
     }
-    // Lock. We can optimize by not locking during large allocations, but this
-    // leads to simpler logic.
+
+    // Try the thread cache if the pool has one
     #if defined(PMALLOC_THREADS)
-        pmalloc_lock_mutex(&pool->mutex);
+        if (pool->flags & PMALLOC_POOL_THREAD_CACHE) {
+            void *const ret = pmalloc_tcache_align(pool, size, align);
+            if (ret != NULL) {
+                return ret;
+            }
+        }
     #endif
 
-    // Compute how much space is needed for allocation. Check to see if we need
-    // to allocate a new page.
-    bool need_new_page = false;
-    const size_t min_page_size =
-        pmalloc_round_up(sizeof(pmalloc_page_header_t), 1ll << align) +
-        size;
-    if (pool->page_size < min_page_size) {
+    return pmalloc_align_shared(pool, size, align);
+}
+
+void *pmalloc_align_shared(pmalloc_pool_t *pool, size_t size, size_t align) {
+    assert(pool);
+    assert(size != 0);
+
+    // Fast path. Try to claim space in the head page without locking. If the
+    // allocation can't fit in a normal page, it gets its own without locking,
+    // unless the page has to come from the arena.
+    const size_t min_page_size = pmalloc_min_page_size(pool, size, align);
+    void *ret;
+    if (pool->page_size >= min_page_size) {
+        ret = pmalloc_bump_head(pool, size, align, min_page_size);
+    } else {
         #if defined(PMALLOC_MULTIPAGE_ALLOC)
-            need_new_page = true;
+            ret = pmalloc_is_shared(pool)
+                ? NULL
+                : pmalloc_align_large(pool, size, align, min_page_size);
         #else
             return NULL;
         #endif
-    } else {
-        // If there is no page in the list and this is our first allocation
-        if (pool->head == NULL) {
-            need_new_page = true;
-        } else {
-            // If the first page in the list is marked as read-only
-            need_new_page |= pool->head->ro;
-            // If there's not enough space left in the page
-            need_new_page |= pool->head->bp_offset < min_page_size;
+    }
+
+    // Slow path. We might need to link in a new page, so lock.
+    if (ret == NULL) {
+        #if defined(PMALLOC_THREADS)
+            pmalloc_lock_mutex(&pool->mutex);
+        #endif
+        ret = pmalloc_align_locked(pool, size, align);
+        #if defined(PMALLOC_THREADS)
+            pmalloc_unlock_mutex(&pool->mutex);
+        #endif
+    }
+    if (ret != NULL) {
+        PMALLOC_STAT_ADD(pool->stats.allocations, 1);
+        PMALLOC_STAT_ADD(pool->stats.allocated_bytes, size);
+        // Get the next page ready if this one is filling up
+        if ((pool->flags & PMALLOC_POOL_PREFAULT)
+                && pmalloc_crossed_mark(pool, ret, size, align)) {
+            pmalloc_refill_spare(pool);
         }
     }
+    return ret;
+}
 
-    // Actually do the allocation
-    void *ret;
-    if (need_new_page) {
-        // Find out what size to use for the new page. Always allocate at least
-        // the given page size, and at least enough to hold what we need.
-        size_t new_page_size =
-            #if defined(PMALLOC_MULTIPAGE_ALLOC)
-                (pool->page_size > min_page_size)
-                    ? pool->page_size
-                    : min_page_size;
-            #else
-                pool->page_size;
-            #endif
-        // Allocate the new page
-        pmalloc_page_header_t *const new_page =
-            pmalloc_alloc_page(&new_page_size);
-        assert(new_page_size >= pool->page_size);
-        assert(new_page_size >= min_page_size);
-        // Set up the fields
-        const size_t new_page_bp =
-            pmalloc_round_down(new_page_size - size, 1ll << align);
-        assert(new_page_bp >= sizeof(pmalloc_page_header_t));
-        assert(new_page_bp % (1ll << align) == 0);
-        new_page->page_size = new_page_size;
-        new_page->bp_offset = new_page_bp;
-        new_page->ro = false;
-        // Link it in
-        new_page->next = pool->head;
-        pool->head = new_page;
-        // Return
-        ret = (char *) new_page + new_page_bp;
-    } else {
-        pool->head->bp_offset =
-            pmalloc_round_down(pool->head->bp_offset - size, 1ll << align);
-        assert(pool->head->bp_offset >= sizeof(pmalloc_page_header_t));
-        assert(pool->head->bp_offset % (1ll << align) == 0);
-        ret = (char *) pool->head + pool->head->bp_offset;
+PMALLOC_API size_t pmalloc_align_many(
+    pmalloc_pool_t *pool,
+    const size_t sizes[],
+    const size_t aligns[],
+    void *out_ptrs[],
+    size_t n
+) {
+    // Error checking the arguments. Like pmalloc_align(), zero-sized objects
+    // just get `NULL`.
+    assert(pool);
+    if (pool == NULL) {
+        return 0;
+    }
+    assert(n == 0 || (sizes && aligns && out_ptrs));
+    if (n != 0 && (sizes == NULL || aligns == NULL || out_ptrs == NULL)) {
+        return 0;
+    }
+
+    // Lock once for the whole batch. Allocations from other threads can still
+    // claim space in the head page concurrently, but that's fine since we use
+    // the same compare-and-swap they do.
+    #if defined(PMALLOC_THREADS)
+        pmalloc_lock_mutex(&pool->mutex);
+    #endif
+
+    size_t i;
+    for (i = 0; i < n; i++) {
+        if (sizes[i] == 0) {
+            out_ptrs[i] = NULL;
+            continue;
+        }
+        out_ptrs[i] = pmalloc_align_locked(pool, sizes[i], aligns[i]);
+        if (out_ptrs[i] == NULL) {
+            break;
+        }
+        PMALLOC_STAT_ADD(pool->stats.allocations, 1);
+        PMALLOC_STAT_ADD(pool->stats.allocated_bytes, sizes[i]);
     }
 
-    // Unlock
     #if defined(PMALLOC_THREADS)
         pmalloc_unlock_mutex(&pool->mutex);
     #endif
-    assert(ret);
-    return ret;
+    return i;
+}
+
+PMALLOC_API size_t pmalloc_array_n(
+    pmalloc_pool_t *pool,
+    size_t size,
+    size_t align,
+    size_t n,
+    void *out[]
+) {
+    // Error checking the arguments
+    assert(pool);
+    if (pool == NULL) {
+        return 0;
+    }
+    assert(n == 0 || out);
+    if (n != 0 && out == NULL) {
+        return 0;
+    }
+    if (size == 0) {
+        for (size_t i = 0; i < n; i++) {
+            out[i] = NULL;
+        }
+        return n;
+    }
+
+    #if defined(PMALLOC_THREADS)
+        pmalloc_lock_mutex(&pool->mutex);
+    #endif
+
+    // Fill the head page with as many objects as fit, then start a new page
+    // with one object and go around again. Objects too big for a normal page
+    // each get their own page.
+    const size_t min_page_size = pmalloc_min_page_size(pool, size, align);
+    size_t i = 0;
+    while (i < n) {
+        if (pool->page_size >= min_page_size) {
+            i += pmalloc_bump_head_n(
+                pool, size, align, min_page_size, n - i, &out[i]);
+            if (i == n) {
+                break;
+            }
+        }
+        out[i] = pmalloc_align_locked(pool, size, align);
+        if (out[i] == NULL) {
+            break;
+        }
+        i++;
+    }
+    PMALLOC_STAT_ADD(pool->stats.allocations, i);
+    PMALLOC_STAT_ADD(pool->stats.allocated_bytes, i * size);
+
+    #if defined(PMALLOC_THREADS)
+        pmalloc_unlock_mutex(&pool->mutex);
+    #endif
+    return i;
+}
+
+PMALLOC_API void pmalloc_pool_stats(
+    pmalloc_pool_t *pool,
+    pmalloc_stats_t *stats
+) {
+    // Error checking the arguments
+    assert(pool);
+    assert(stats);
+    if (pool == NULL || stats == NULL) {
+        return;
+    }
+
+    #if defined(PMALLOC_STATS)
+        #define PMALLOC_STAT_LOAD(field) \
+            stats->field = PMALLOC_ATOMIC_LOAD(&pool->stats.field)
+        PMALLOC_STAT_LOAD(pages);
+        PMALLOC_STAT_LOAD(page_bytes);
+        PMALLOC_STAT_LOAD(allocations);
+        PMALLOC_STAT_LOAD(allocated_bytes);
+        PMALLOC_STAT_LOAD(waste_alignment);
+        PMALLOC_STAT_LOAD(waste_page_tail);
+        PMALLOC_STAT_LOAD(waste_protect);
+        PMALLOC_STAT_LOAD(protects);
+        PMALLOC_STAT_LOAD(map_calls);
+        PMALLOC_STAT_LOAD(protect_calls);
+        PMALLOC_STAT_LOAD(trimmed_bytes);
+        #undef PMALLOC_STAT_LOAD
+    #else
+        *stats = (pmalloc_stats_t) {0};
+    #endif
+}
+
+PMALLOC_API void pmalloc_global_stats(pmalloc_global_stats_t *stats) {
+    // Error checking the arguments
+    assert(stats);
+    if (stats == NULL) {
+        return;
+    }
+
+    #if defined(PMALLOC_STATS)
+        #define PMALLOC_STAT_LOAD(field) \
+            stats->field = PMALLOC_ATOMIC_LOAD(&pmalloc_global_counters.field)
+        PMALLOC_STAT_LOAD(pools);
+        PMALLOC_STAT_LOAD(pages);
+        PMALLOC_STAT_LOAD(page_bytes);
+        PMALLOC_STAT_LOAD(map_calls);
+        PMALLOC_STAT_LOAD(unmap_calls);
+        PMALLOC_STAT_LOAD(protect_calls);
+        PMALLOC_STAT_LOAD(advise_calls);
+        PMALLOC_STAT_LOAD(page_cache_hits);
+        PMALLOC_STAT_LOAD(page_cache_bytes);
+        #undef PMALLOC_STAT_LOAD
+    #else
+        *stats = (pmalloc_global_stats_t) {0};
+    #endif
 }
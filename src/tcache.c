@@ -0,0 +1,106 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2022  Ammar Ratnani <ammrat13@gmail.com>
+
+#include <assert.h>
+#include <stdint.h>
+
+#include "pmalloc/internals.h"
+
+// Thread caches only make sense if there are threads.
+#if !defined(PMALLOC_THREADS)
+#   error "This file should only be compiled if the library is thread-safe"
+#endif
+
+/** \brief How many pools each thread can hold a chunk of at once */
+#define PMALLOC_TCACHE_SLOTS 8
+/** \brief Log-base-2 of the alignment of each chunk
+ *
+ * Chunks are aligned to a cache line so that two threads never write to the
+ * same one.
+ */
+#define PMALLOC_TCACHE_ALIGN 6
+
+
+/** \brief A thread's chunk of a pool
+ *
+ * Allocation within a chunk goes downward, just like allocation within a page.
+ * The addresses are stored as integers so that an empty slot, with everything
+ * zero, can be handled without special cases.
+ */
+typedef struct pmalloc_tcache_t {
+    size_t id;  ///< The pmalloc_pool_t::id of the pool this chunk is from
+    size_t epoch;  ///< The pmalloc_pool_t::epoch when the chunk was taken
+    uintptr_t lo;  ///< The lowest address in the chunk
+    uintptr_t bp;  ///< The boundary pointer, like pmalloc_page_header_t
+} pmalloc_tcache_t;
+
+static PMALLOC_THREAD_LOCAL pmalloc_tcache_t
+    pmalloc_tcache[PMALLOC_TCACHE_SLOTS];
+
+
+/** \brief Try to allocate from a chunk without refilling it
+ * \return Pointer to the allocated memory, or `NULL` if it doesn't fit
+ */
+static void *pmalloc_tcache_bump(
+    pmalloc_tcache_t *chunk,
+    size_t size,
+    size_t align
+) {
+    if (chunk->bp - chunk->lo < size) {
+        return NULL;
+    }
+    const uintptr_t new_bp = pmalloc_align_down(chunk->bp - size, align);
+    if (new_bp < chunk->lo) {
+        return NULL;
+    }
+    chunk->bp = new_bp;
+    return (void *) new_bp;
+}
+
+void *pmalloc_tcache_align(pmalloc_pool_t *pool, size_t size, size_t align) {
+    assert(pool);
+    assert(pool->flags & PMALLOC_POOL_THREAD_CACHE);
+
+    // Figure out how big the chunks for this pool are. They have to fit in a
+    // page with the header, if it's in the page, otherwise we'd map a page per
+    // chunk. Only small allocations are served from the chunk, so that one
+    // allocation doesn't use up most of it.
+    const size_t header_size = pmalloc_align_up(
+        pool->header_size, PMALLOC_TCACHE_ALIGN);
+    if (pool->page_size <= header_size) {
+        return NULL;
+    }
+    const size_t chunk_size =
+        (pool->page_size - header_size < PMALLOC_THREAD_CACHE_CHUNK)
+            ? pool->page_size - header_size
+            : PMALLOC_THREAD_CACHE_CHUNK;
+    if (size > chunk_size / 4 || align > PMALLOC_TCACHE_ALIGN) {
+        return NULL;
+    }
+
+    // Try the chunk we already have, as long as it's for this pool and it
+    // hasn't been protected since we got it
+    pmalloc_tcache_t *const chunk =
+        &pmalloc_tcache[pool->id % PMALLOC_TCACHE_SLOTS];
+    const size_t epoch = PMALLOC_ATOMIC_LOAD(&pool->epoch);
+    if (chunk->id == pool->id && chunk->epoch == epoch) {
+        void *const ret = pmalloc_tcache_bump(chunk, size, align);
+        if (ret != NULL) {
+            return ret;
+        }
+    }
+
+    // Get a new chunk. Whatever was left in the old one is wasted. Note that
+    // the epoch was read before allocating, so if the pool is protected in the
+    // meantime, we'll throw this chunk out next time.
+    void *const new_chunk =
+        pmalloc_align_shared(pool, chunk_size, PMALLOC_TCACHE_ALIGN);
+    if (new_chunk == NULL) {
+        return NULL;
+    }
+    chunk->id = pool->id;
+    chunk->epoch = epoch;
+    chunk->lo = (uintptr_t) new_chunk;
+    chunk->bp = (uintptr_t) new_chunk + chunk_size;
+    return pmalloc_tcache_bump(chunk, size, align);
+}
@@ -0,0 +1,52 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2022  Ammar Ratnani <ammrat13@gmail.com>
+
+#include <assert.h>
+#include <stdint.h>
+
+#include "pmalloc/pmalloc.h"
+#include "pmalloc/internals.h"
+
+#define NUM_OBJECTS 1000
+
+
+int main(void) {
+    // Same-size objects should be packed exactly like single allocations
+    pmalloc_pool_t *pool = pmalloc_create_pool();
+    pmalloc_pool_t *reference = pmalloc_create_pool();
+
+    void *xs[NUM_OBJECTS];
+    size_t n = pmalloc_array_n(pool, 12, 3, NUM_OBJECTS, xs);
+    assert(n == NUM_OBJECTS);
+    for (size_t i = 0; i < NUM_OBJECTS; i++) {
+        void *y = pmalloc_align(reference, 12, 3);
+        assert(xs[i] != NULL);
+        assert((uintptr_t) xs[i] % 8 == 0);
+        assert(
+            (uintptr_t) xs[i] % PMALLOC_DEFAULT_PAGESIZE ==
+            (uintptr_t) y % PMALLOC_DEFAULT_PAGESIZE);
+        *(char *) xs[i] = 'A';
+    }
+    // Objects that don't fit in a page overflow onto a new one
+    assert(pool->head->next);
+
+    // Mixed sizes, including empty objects
+    size_t sizes[] = {1, 0, 100, 7, 3000, 2};
+    size_t aligns[] = {0, 0, 4, 2, 3, 1};
+    void *ys[6];
+    n = pmalloc_align_many(pool, sizes, aligns, ys, 6);
+    assert(n == 6);
+    assert(ys[1] == NULL);
+    for (size_t i = 0; i < 6; i++) {
+        assert((uintptr_t) ys[i] % (1ull << aligns[i]) == 0);
+        for (size_t j = 0; j < i; j++) {
+            char *yi = ys[i];
+            char *yj = ys[j];
+            assert(yi + sizes[i] <= yj || yi >= yj + sizes[j]);
+        }
+    }
+
+    pmalloc_destroy_pool(reference);
+    pmalloc_destroy_pool(pool);
+    return 0;
+}
@@ -0,0 +1,101 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2022  Ammar Ratnani <ammrat13@gmail.com>
+
+#include <assert.h>
+
+#include "pmalloc/pmalloc.h"
+#include "pmalloc/internals.h"
+
+
+static bool in_page(pmalloc_page_header_t *page, char *x) {
+    return x >= page->base && x < page->base + page->page_size;
+}
+
+int main(void) {
+    pmalloc_pool_attr_t attr;
+    pmalloc_pool_attr_init(&attr);
+    attr.flags |= PMALLOC_POOL_BEST_FIT;
+    pmalloc_pool_t *pool = pmalloc_create_attr_pool(&attr);
+    assert(pool);
+    const size_t page_size = PMALLOC_DEFAULT_PAGESIZE;
+
+    // The first page is kept open when the second is started
+    char *a = pmalloc(pool, page_size / 2);
+    pmalloc_page_header_t *first = pool->head;
+    char *b = pmalloc(pool, page_size * 3 / 4);
+    pmalloc_page_header_t *second = pool->head;
+    assert(first != second);
+    assert(pool->open_count == 1);
+    assert(pool->open[0] == first);
+
+    // Objects that don't fit in the head go in the open page
+    char *c = pmalloc(pool, page_size / 3);
+    assert(pool->head == second);
+    assert(in_page(first, c));
+
+    // The open page with the least room that fits is picked
+    char *d = pmalloc(pool, page_size * 7 / 8);
+    pmalloc_page_header_t *third = pool->head;
+    assert(third != second);
+    assert(pool->open_count == 2);
+    assert(pool->open[0] == first);
+    assert(pool->open[1] == second);
+    char *e = pmalloc(pool, page_size / 8);
+    assert(in_page(first, e));
+    char *f = pmalloc(pool, page_size / 5);
+    assert(in_page(second, f));
+
+    *a = 'A';
+    *b = 'B';
+    *c = 'C';
+    *d = 'D';
+    *e = 'E';
+    *f = 'F';
+
+    // Protecting seals the open pages too. They're whole OS pages, so there's
+    // no room left in them afterwards.
+    pmalloc_protect_pool(pool);
+    assert(first->ro);
+    assert(second->ro);
+    assert(pool->open_count == 0);
+    assert(*a == 'A' && *b == 'B' && *c == 'C');
+    assert(*d == 'D' && *e == 'E' && *f == 'F');
+
+    pmalloc_destroy_pool(pool);
+
+    // Fill up the open pages, and seal them partway
+    const size_t os_page_size = pmalloc_get_page_size();
+    attr.page_size = 4 * os_page_size;
+    pool = pmalloc_create_attr_pool(&attr);
+    assert(pool);
+    for (size_t i = 0; i <= PMALLOC_OPEN_PAGES; i++) {
+        pmalloc(pool, 3 * os_page_size);
+    }
+    assert(pool->open_count == PMALLOC_OPEN_PAGES);
+    pmalloc_protect_pool(pool);
+    pmalloc_page_header_t *head = pool->head;
+    assert(pool->sealed == head->next);
+
+    // Allocate in the open page that's past where protecting stops, then
+    // retire it for a page with more room
+    char *g = pmalloc(pool, os_page_size * 3 / 4);
+    assert(pool->head == head);
+    char *h = pmalloc(pool, os_page_size * 7 / 8);
+    pmalloc_page_header_t *dirty = pool->open[0];
+    assert(in_page(dirty, h));
+    pmalloc(pool, 3 * os_page_size);
+    assert(pool->head != head);
+    for (size_t i = 0; i < pool->open_count; i++) {
+        assert(pool->open[i] != dirty);
+    }
+    *g = 'G';
+    *h = 'H';
+
+    // It still gets sealed
+    pmalloc_protect_pool(pool);
+    assert(dirty->ro);
+    assert(*g == 'G' && *h == 'H');
+
+    pmalloc_destroy_pool(pool);
+    return 0;
+}
@@ -0,0 +1,60 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2022  Ammar Ratnani <ammrat13@gmail.com>
+
+#include <assert.h>
+
+#include "pmalloc/pmalloc.h"
+#include "pmalloc/internals.h"
+
+// Enough pages to need more than one header table
+#define NUM_PAGES (2 * PMALLOC_HEADER_TABLE_SIZE + 1)
+
+
+int main(void) {
+    pmalloc_pool_attr_t attr;
+    pmalloc_pool_attr_init(&attr);
+    attr.flags |= PMALLOC_POOL_EXTERNAL_HEADERS;
+    pmalloc_pool_t *pool = pmalloc_create_attr_pool(&attr);
+    assert(pool);
+    assert(pool->header_size == 0);
+
+    // The whole page is available for objects, and the header isn't in it
+    char *x = pmalloc(pool, PMALLOC_DEFAULT_PAGESIZE);
+    pmalloc_page_header_t *page = pool->head;
+    assert(page != NULL);
+    assert(page->next == NULL);
+    assert(x == page->base + page->page_size - PMALLOC_DEFAULT_PAGESIZE);
+    assert(
+        (char *) page < page->base ||
+        (char *) page >= page->base + page->page_size);
+    x[0] = 'A';
+    x[PMALLOC_DEFAULT_PAGESIZE - 1] = 'B';
+
+    // Headers are still correct once there are many pages
+    char *pages[NUM_PAGES];
+    for (size_t i = 0; i < NUM_PAGES; i++) {
+        pages[i] = pmalloc(pool, PMALLOC_DEFAULT_PAGESIZE);
+        pages[i][0] = (char) i;
+    }
+    pmalloc_page_header_t *cur = pool->head;
+    for (size_t i = NUM_PAGES; i-- > 0;) {
+        assert(
+            cur->base + cur->page_size - PMALLOC_DEFAULT_PAGESIZE == pages[i]);
+        cur = cur->next;
+    }
+    assert(cur == page);
+
+    // Protecting works the same way
+    pmalloc_protect_pool(pool);
+    for (cur = pool->head; cur != NULL; cur = cur->next) {
+        assert(cur->ro);
+    }
+    for (size_t i = 0; i < NUM_PAGES; i++) {
+        assert(pages[i][0] == (char) i);
+    }
+    assert(x[0] == 'A');
+    assert(x[PMALLOC_DEFAULT_PAGESIZE - 1] == 'B');
+
+    pmalloc_destroy_pool(pool);
+    return 0;
+}
@@ -0,0 +1,52 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2022  Ammar Ratnani <ammrat13@gmail.com>
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "pmalloc/pmalloc.h"
+#include "pmalloc/inline.h"
+
+#define NUM_OBJECTS 1000
+
+
+int main(void) {
+    const unsigned all_flags[] = {
+        0,
+        PMALLOC_POOL_EXTERNAL_HEADERS,
+        PMALLOC_POOL_THREAD_CACHE,
+    };
+    for (size_t f = 0; f < sizeof(all_flags) / sizeof(all_flags[0]); f++) {
+        pmalloc_pool_attr_t attr;
+        pmalloc_pool_attr_init(&attr);
+        attr.flags |= all_flags[f];
+        pmalloc_pool_t *a = pmalloc_create_attr_pool(&attr);
+        pmalloc_pool_t *b = pmalloc_create_attr_pool(&attr);
+
+        // The inline path puts objects where pmalloc_align() would. The first
+        // allocation in each pool maps a page through the library.
+        for (size_t i = 0; i < NUM_OBJECTS; i++) {
+            const size_t size = 1 + i % 100;
+            char *x = pmalloc_inline_align(a, size, 4);
+            char *y = pmalloc_align(b, size, 4);
+            assert((uintptr_t) x % 16 == 0);
+            // Objects in thread caches aren't always in the head page
+            if (!(attr.flags & PMALLOC_POOL_THREAD_CACHE)) {
+                assert(x - a->head->base == y - b->head->base);
+            }
+            memset(x, 'A', size);
+        }
+
+        // It falls back to the library when the head is read only
+        pmalloc_protect_pool(a);
+        char *x = pmalloc_inline(a, 8);
+        assert(x);
+        memset(x, 'B', 8);
+        assert(pmalloc_inline(a, 0) == NULL);
+
+        pmalloc_destroy_pool(a);
+        pmalloc_destroy_pool(b);
+    }
+    return 0;
+}
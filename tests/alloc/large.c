@@ -0,0 +1,53 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2022  Ammar Ratnani <ammrat13@gmail.com>
+
+#include <assert.h>
+
+#include "pmalloc/pmalloc.h"
+#include "pmalloc/internals.h"
+
+
+static void check(unsigned flags) {
+    pmalloc_pool_attr_t attr;
+    pmalloc_pool_attr_init(&attr);
+    attr.flags |= flags;
+    pmalloc_pool_t *pool = pmalloc_create_attr_pool(&attr);
+
+    char *x = pmalloc_align(pool, 1, 0);
+    pmalloc_page_header_t *head = pool->head;
+
+    // Objects too big for a page don't replace the head
+    char *y = pmalloc_align(pool, 2 * PMALLOC_DEFAULT_PAGESIZE, 0);
+    assert(pool->head == head);
+    assert(pool->large != NULL);
+    assert(pool->large->next == NULL);
+    assert(y >= pool->large->base);
+    assert(y + 2 * PMALLOC_DEFAULT_PAGESIZE
+        == pool->large->base + pool->large->page_size);
+    char *z = pmalloc_align(pool, 3 * PMALLOC_DEFAULT_PAGESIZE, 0);
+    assert(pool->large->next != NULL);
+
+    // So small objects keep going in the same page
+    char *w = pmalloc_align(pool, 1, 0);
+    assert(pool->head == head);
+    assert(w + 1 == x);
+
+    *x = 'A';
+    *y = 'B';
+    *z = 'C';
+    *w = 'D';
+
+    // Protecting seals both kinds of page
+    pmalloc_protect_pool(pool);
+    assert(pool->large->ro);
+    assert(pool->large->next->ro);
+    assert(*x == 'A' && *y == 'B' && *z == 'C' && *w == 'D');
+
+    pmalloc_destroy_pool(pool);
+}
+
+int main(void) {
+    check(0);
+    check(PMALLOC_POOL_EXTERNAL_HEADERS);
+    return 0;
+}
@@ -0,0 +1,52 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2022  Ammar Ratnani <ammrat13@gmail.com>
+
+#include <assert.h>
+#include <string.h>
+
+#include "pmalloc/pmalloc.h"
+#include "pmalloc/internals.h"
+
+
+int main(void) {
+    const unsigned all_flags[] = {
+        0,
+        PMALLOC_POOL_EXTERNAL_HEADERS,
+        PMALLOC_POOL_ARENA,
+    };
+    for (size_t f = 0; f < sizeof(all_flags) / sizeof(all_flags[0]); f++) {
+        pmalloc_pool_attr_t attr;
+        pmalloc_pool_attr_init(&attr);
+        attr.flags |= PMALLOC_POOL_PREFAULT | all_flags[f];
+        attr.page_size = 4 * PMALLOC_DEFAULT_PAGESIZE;
+        pmalloc_pool_t *pool = pmalloc_create_attr_pool(&attr);
+        assert(pool);
+
+        // There's no spare page until the head is half full
+        memset(pmalloc(pool, 16), 'A', 16);
+        pmalloc_page_header_t *const first = pool->head;
+        assert(pool->spare == NULL);
+        while (first->bp_offset >= first->page_size / 2) {
+            memset(pmalloc(pool, 16), 'A', 16);
+        }
+        pmalloc_page_header_t *const spare = pool->spare;
+        assert(spare != NULL);
+        assert(spare->next == NULL);
+
+        // The spare page becomes the head when the first one is full, and
+        // another one is made when that one is half full
+        while (pool->head == first) {
+            memset(pmalloc(pool, 16), 'B', 16);
+        }
+        assert(pool->head == spare);
+        assert(pool->spare == NULL);
+        while (spare->bp_offset >= spare->page_size / 2) {
+            memset(pmalloc(pool, 16), 'B', 16);
+        }
+        assert(pool->spare != NULL);
+        assert(pool->spare != spare);
+
+        pmalloc_destroy_pool(pool);
+    }
+    return 0;
+}
@@ -0,0 +1,78 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2022  Ammar Ratnani <ammrat13@gmail.com>
+
+#include <assert.h>
+#include <string.h>
+
+#include "pmalloc/pmalloc.h"
+#include "pmalloc/internals.h"
+
+#define NUM_OBJECTS 1000
+
+
+/** \brief Count the pages in a list */
+static size_t count_pages(pmalloc_page_header_t *page) {
+    size_t ret = 0;
+    for (; page != NULL; page = page->next) {
+        ret++;
+    }
+    return ret;
+}
+
+
+int main(void) {
+    pmalloc_pool_t *pool = pmalloc_create_pool();
+
+    // Fill a few pages and protect them
+    char *first = pmalloc(pool, 16);
+    for (size_t i = 0; i < NUM_OBJECTS; i++) {
+        memset(pmalloc(pool, 16), 'A', 16);
+    }
+    pmalloc_protect_pool(pool);
+    const size_t pages = count_pages(pool->head);
+    assert(pages > 1);
+
+    // Resetting keeps the pages, and the first object goes in the same place
+    // as before. It has to be writable again.
+    pmalloc_reset_pool(pool);
+    assert(pool->head == NULL);
+    assert(count_pages(pool->spare) == pages);
+    char *x = pmalloc(pool, 16);
+    assert(x == first);
+    memset(x, 'B', 16);
+    for (size_t i = 0; i < NUM_OBJECTS; i++) {
+        memset(pmalloc(pool, 16), 'B', 16);
+    }
+    assert(count_pages(pool->head) == pages);
+    assert(pool->spare == NULL);
+
+    // Rewinding frees everything allocated after the mark
+    pmalloc_mark_t outer = pmalloc_mark(pool);
+    char *y = pmalloc(pool, 16);
+    pmalloc_mark_t inner = pmalloc_mark(pool);
+    for (size_t i = 0; i < NUM_OBJECTS; i++) {
+        memset(pmalloc(pool, 16), 'C', 16);
+    }
+    assert(count_pages(pool->head) > pages);
+    assert(pmalloc_rewind(pool, inner));
+    assert(count_pages(pool->head) == pages);
+    assert(pmalloc(pool, 16) == y - 16);
+    assert(pmalloc_rewind(pool, outer));
+    assert(pmalloc(pool, 16) == y);
+
+    // Marks from before the pool was protected can't be used
+    pmalloc_mark_t old = pmalloc_mark(pool);
+    pmalloc(pool, 16);
+    pmalloc_protect_pool(pool);
+    assert(!pmalloc_rewind(pool, old));
+
+    // Marks in an empty pool rewind to an empty pool
+    pmalloc_reset_pool(pool);
+    pmalloc_mark_t empty = pmalloc_mark(pool);
+    pmalloc(pool, 16);
+    assert(pmalloc_rewind(pool, empty));
+    assert(pool->head == NULL);
+
+    pmalloc_destroy_pool(pool);
+    return 0;
+}
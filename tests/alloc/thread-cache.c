@@ -0,0 +1,105 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2022  Ammar Ratnani <ammrat13@gmail.com>
+
+#include <assert.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "pmalloc/pmalloc.h"
+#include "pmalloc/internals.h"
+
+// More pools than a thread has cache slots, so some of them share one
+#define NUM_POOLS 9
+#define NUM_ROUNDS 4
+
+static pmalloc_pool_t *pool;
+
+static void *alloc_one(void *arg) {
+    *(char **) arg = pmalloc(pool, 8);
+    return NULL;
+}
+
+/** \brief Allocate once from `pool` on a new thread, which then exits */
+static char *alloc_in_thread(void) {
+    char *ret = NULL;
+    pthread_t thread;
+    int err = pthread_create(&thread, NULL, alloc_one, &ret);
+    assert(err == 0);
+    err = pthread_join(thread, NULL);
+    assert(err == 0);
+    (void) err;
+    return ret;
+}
+
+/** \brief The start of the chunk the last refill took from `p` */
+static char *last_chunk(pmalloc_pool_t *p) {
+    return p->head->base + p->head->bp_offset;
+}
+
+static bool in_chunk(char *chunk, char *x) {
+    return x >= chunk && x < chunk + PMALLOC_THREAD_CACHE_CHUNK;
+}
+
+static pmalloc_pool_t *create_pool(void) {
+    pmalloc_pool_attr_t attr;
+    pmalloc_pool_attr_init(&attr);
+    attr.flags |= PMALLOC_POOL_THREAD_CACHE;
+    pmalloc_pool_t *const ret = pmalloc_create_attr_pool(&attr);
+    assert(ret);
+    return ret;
+}
+
+
+int main(void) {
+    pool = create_pool();
+
+    // Small objects come out of the thread's chunk, without going back to the
+    // head page
+    char *x = pmalloc(pool, 8);
+    char *const chunk = last_chunk(pool);
+    assert(in_chunk(chunk, x));
+    for (size_t i = 0; i < 4; i++) {
+        char *y = pmalloc(pool, 8);
+        assert(y < x);
+        assert(in_chunk(chunk, y));
+        assert(last_chunk(pool) == chunk);
+        x = y;
+    }
+
+    // Threads that exit don't hand their chunks to the ones that come after
+    char *y = alloc_in_thread();
+    assert(!in_chunk(chunk, y));
+    char *const other_chunk = last_chunk(pool);
+    assert(in_chunk(other_chunk, y));
+    char *z = alloc_in_thread();
+    assert(!in_chunk(chunk, z));
+    assert(!in_chunk(other_chunk, z));
+
+    // The chunk of a destroyed pool isn't used for a new one, even if the new
+    // one gets the same memory
+    pmalloc_destroy_pool(pool);
+    pool = create_pool();
+    x = pmalloc(pool, 8);
+    assert(pool->head != NULL);
+    assert(in_chunk(last_chunk(pool), x));
+    pmalloc_destroy_pool(pool);
+
+    // Pools that share a slot take turns with it, and every object still goes
+    // in its own pool
+    pmalloc_pool_t *pools[NUM_POOLS];
+    for (size_t i = 0; i < NUM_POOLS; i++) {
+        pools[i] = create_pool();
+    }
+    for (size_t r = 0; r < NUM_ROUNDS; r++) {
+        for (size_t i = 0; i < NUM_POOLS; i++) {
+            char *const obj = pmalloc(pools[i], 8);
+            const pmalloc_page_header_t *const head = pools[i]->head;
+            assert(obj >= head->base && obj < head->base + head->page_size);
+        }
+    }
+    for (size_t i = 0; i < NUM_POOLS; i++) {
+        pmalloc_destroy_pool(pools[i]);
+    }
+
+    return 0;
+}
@@ -0,0 +1,91 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2022  Ammar Ratnani <ammrat13@gmail.com>
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "pmalloc/pmalloc.h"
+#include "pmalloc/internals.h"
+
+#define NUM_THREADS 8
+#define NUM_ALLOCS 2000
+
+typedef struct range_t {
+    uintptr_t start;
+    size_t size;
+} range_t;
+
+static pmalloc_pool_t *pool;
+static range_t ranges[NUM_THREADS][NUM_ALLOCS];
+
+static void *worker(void *arg) {
+    const uintptr_t id = (uintptr_t) arg;
+    range_t *const rs = ranges[id];
+    for (size_t i = 0; i < NUM_ALLOCS; i++) {
+        const size_t size = 1 + (i * 7) % 61;
+        const size_t align = i % 5;
+        unsigned char *x = pmalloc_align(pool, size, align);
+        assert(x);
+        assert((uintptr_t) x % (1ull << align) == 0);
+        rs[i].start = (uintptr_t) x;
+        rs[i].size = size;
+        // Fill the allocation with a pattern unique to this thread. If another
+        // thread got an overlapping range, it'll clobber this.
+        for (size_t j = 0; j < size; j++) {
+            x[j] = (unsigned char) id;
+        }
+    }
+    for (size_t i = 0; i < NUM_ALLOCS; i++) {
+        const unsigned char *x = (const unsigned char *) rs[i].start;
+        for (size_t j = 0; j < rs[i].size; j++) {
+            assert(x[j] == (unsigned char) id);
+        }
+    }
+    return NULL;
+}
+
+static int compare_ranges(const void *a, const void *b) {
+    const range_t *ra = a;
+    const range_t *rb = b;
+    return (ra->start > rb->start) - (ra->start < rb->start);
+}
+
+
+/** \brief Allocate from all the threads at once in a pool with `flags` */
+static void run_threads(unsigned flags) {
+    pmalloc_pool_attr_t attr;
+    pmalloc_pool_attr_init(&attr);
+    attr.flags |= flags;
+    pool = pmalloc_create_attr_pool(&attr);
+    assert(pool);
+
+    pthread_t threads[NUM_THREADS];
+    for (size_t i = 0; i < NUM_THREADS; i++) {
+        int ret = pthread_create(
+            &threads[i], NULL, worker, (void *) (uintptr_t) i);
+        assert(ret == 0);
+    }
+    for (size_t i = 0; i < NUM_THREADS; i++) {
+        int ret = pthread_join(threads[i], NULL);
+        assert(ret == 0);
+    }
+
+    // Check that no two ranges overlap, across all the threads
+    range_t *all = &ranges[0][0];
+    qsort(all, NUM_THREADS * NUM_ALLOCS, sizeof(range_t), compare_ranges);
+    for (size_t i = 1; i < NUM_THREADS * NUM_ALLOCS; i++) {
+        assert(all[i - 1].start + all[i - 1].size <= all[i].start);
+    }
+
+    pmalloc_destroy_pool(pool);
+}
+
+
+int main(void) {
+    run_threads(0);
+    // Threads refill their chunks many times over
+    run_threads(PMALLOC_POOL_THREAD_CACHE);
+    return 0;
+}
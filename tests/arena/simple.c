@@ -0,0 +1,47 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2022  Ammar Ratnani <ammrat13@gmail.com>
+
+#include <assert.h>
+
+#include "pmalloc/pmalloc.h"
+#include "pmalloc/internals.h"
+
+
+int main(void) {
+    pmalloc_pool_attr_t attr;
+    pmalloc_pool_attr_init(&attr);
+    attr.flags |= PMALLOC_POOL_ARENA;
+    attr.arena_size = 4 * PMALLOC_DEFAULT_PAGESIZE;
+    pmalloc_pool_t *pool = pmalloc_create_attr_pool(&attr);
+    assert(pool);
+    assert(pool->arena.base != NULL);
+
+    // Pages are taken from the arena in order
+    char *x = pmalloc(pool, PMALLOC_DEFAULT_PAGESIZE / 2);
+    assert((char *) pool->head == pool->arena.base);
+    char *y = pmalloc(pool, PMALLOC_DEFAULT_PAGESIZE / 2);
+    assert((char *) pool->head == pool->arena.base + PMALLOC_DEFAULT_PAGESIZE);
+    assert(pool->arena.committed == 2 * PMALLOC_DEFAULT_PAGESIZE);
+    *x = 'A';
+    *y = 'B';
+
+    // Protecting seals everything committed so far
+    pmalloc_protect_pool(pool);
+    assert(pool->head->ro);
+    assert(pool->head->next->ro);
+    assert(*x == 'A');
+    assert(*y == 'B');
+
+    // Once the arena runs out, pages come from outside it
+    for (int i = 0; i < 3; i++) {
+        char *z = pmalloc(pool, PMALLOC_DEFAULT_PAGESIZE / 2);
+        *z = 'C';
+    }
+    assert(pool->arena.committed == pool->arena.size);
+    assert(!pmalloc_in_arena(&pool->arena, pool->head));
+    assert(pmalloc_in_arena(&pool->arena, pool->head->next));
+
+    pmalloc_protect_pool(pool);
+    pmalloc_destroy_pool(pool);
+    return 0;
+}
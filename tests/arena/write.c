@@ -0,0 +1,37 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2022  Ammar Ratnani <ammrat13@gmail.com>
+
+#include <assert.h>
+#include <stdlib.h>
+#include <signal.h>
+
+#include "pmalloc/pmalloc.h"
+#include "pmalloc/internals.h"
+
+void segv_handler(int signal) {
+    assert(signal == SIGSEGV);
+    exit(0);
+}
+
+
+int main(void) {
+    signal(SIGSEGV, segv_handler);
+
+    pmalloc_pool_attr_t attr;
+    pmalloc_pool_attr_init(&attr);
+    attr.flags |= PMALLOC_POOL_ARENA;
+    pmalloc_pool_t *pool = pmalloc_create_attr_pool(&attr);
+
+    char *x = pmalloc(pool, 1);
+    char *y = pmalloc(pool, PMALLOC_DEFAULT_PAGESIZE / 2);
+    char *z = pmalloc(pool, PMALLOC_DEFAULT_PAGESIZE / 2);
+    pmalloc_protect_pool(pool);
+
+    char *w = pmalloc(pool, 1);
+    *w = 'D';
+    assert(*y == 0);
+
+    *x = 'A';
+
+    assert(false);
+}
@@ -0,0 +1,45 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2022  Ammar Ratnani <ammrat13@gmail.com>
+
+#include <assert.h>
+
+#include "pmalloc/pmalloc.h"
+#include "pmalloc/internals.h"
+
+
+int main(void) {
+    // Fill a page, protect it, and give it back to the cache
+    pmalloc_pool_t *pool = pmalloc_create_pool();
+    char *x = pmalloc(pool, 1);
+    *x = 'A';
+    pmalloc_protect_pool(pool);
+    pmalloc_page_header_t *page = pool->head;
+    pmalloc_destroy_pool(pool);
+
+    // The next page of the same size should be the same one. It should be
+    // writable again.
+    pool = pmalloc_create_pool();
+    char *y = pmalloc(pool, 1);
+    assert(pool->head == page);
+    assert(y == x);
+    #if defined(PMALLOC_STATS)
+        // It didn't take a system call
+        pmalloc_stats_t stats;
+        pmalloc_pool_stats(pool, &stats);
+        assert(stats.pages == 1);
+        assert(stats.map_calls == 0);
+    #endif
+    #if !defined(PMALLOC_PAGE_CACHE_LAZYFREE)
+        assert(*y == 0);
+    #endif
+    *y = 'B';
+
+    // With the cache disabled, pages are unmapped right away
+    pmalloc_set_page_cache_limit(0);
+    pmalloc_destroy_pool(pool);
+    pool = pmalloc_create_pool();
+    pmalloc(pool, 1);
+    pmalloc_destroy_pool(pool);
+
+    return 0;
+}
@@ -0,0 +1,81 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2022  Ammar Ratnani <ammrat13@gmail.com>
+
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "pmalloc/pmalloc.hpp"
+
+#define NUM_OBJECTS 1000
+// Small enough that a vector's storage always fits in a page
+#define NUM_ELEMENTS 100
+
+
+struct alignas(64) line_t {
+    explicit line_t(int v) : value(v) {}
+    int value;
+};
+
+typedef std::basic_string<
+    char, std::char_traits<char>, pmalloc::allocator<char>> string_t;
+typedef std::map<
+    int, int, std::less<int>,
+    pmalloc::allocator<std::pair<const int, int>>> map_t;
+
+
+int main() {
+    static_assert(pmalloc::detail::align_of<char>::value == 0, "");
+    static_assert(pmalloc::detail::align_of<std::uint64_t>::value == 3, "");
+    static_assert(pmalloc::detail::align_of<line_t>::value == 6, "");
+
+    pmalloc::pool pool;
+
+    // Objects are constructed with their alignment
+    for (int i = 0; i < NUM_OBJECTS; i++) {
+        line_t *l = pool.make<line_t>(i);
+        assert(reinterpret_cast<std::uintptr_t>(l) % 64 == 0);
+        assert(l->value == i);
+    }
+
+    // Containers allocate from the pool. They have to be destroyed before it.
+    {
+        std::vector<int, pmalloc::allocator<int>> v(pool);
+        for (int i = 0; i < NUM_ELEMENTS; i++) {
+            v.push_back(i);
+        }
+        assert(v[NUM_ELEMENTS - 1] == NUM_ELEMENTS - 1);
+        string_t s("a string too long to fit in the small buffer", pool);
+        s += s;
+        assert(s.size() == 88);
+        map_t m(pool);
+        for (int i = 0; i < NUM_OBJECTS; i++) {
+            m[i] = -i;
+        }
+        assert(m.at(NUM_OBJECTS / 2) == -NUM_OBJECTS / 2);
+        assert(
+            pmalloc::allocator<int>(pool)
+                == pmalloc::allocator<std::int64_t>(pool));
+    }
+
+    // Allocating nothing gives nothing
+    assert(pool.allocate<int>(0) == nullptr);
+    assert(pmalloc::allocator<int>(pool).allocate(0) == nullptr);
+
+    // Moving transfers ownership
+    pmalloc::pool other = std::move(pool);
+    assert(!pool);
+    assert(other);
+
+    // Sealing gives a read-only view
+    int *x = other.make<int>(42);
+    pmalloc::sealed<int> view = other.seal(x);
+    assert(*view == 42);
+    assert(view.get() == x);
+
+    return 0;
+}
@@ -0,0 +1,76 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2022  Ammar Ratnani <ammrat13@gmail.com>
+
+#include <assert.h>
+
+#include "pmalloc/pmalloc.h"
+#include "pmalloc/internals.h"
+
+
+int main(void) {
+    const size_t os_page_size = pmalloc_get_page_size();
+    pmalloc_group_t *group = pmalloc_create_group(16 * os_page_size);
+    assert(group);
+
+    // Pages that are a single OS page are sealed whole
+    pmalloc_pool_attr_t attr;
+    pmalloc_pool_attr_init(&attr);
+    attr.page_size = os_page_size;
+    pmalloc_pool_t *a = pmalloc_create_group_pool(group, &attr);
+    pmalloc_pool_t *b = pmalloc_create_group_pool(group, &attr);
+    pmalloc_pool_t *c = pmalloc_create_group_pool(group, &attr);
+    assert(a && b && c);
+    assert(a->arena.base == NULL);
+
+    // Pages are taken from the group in the order they're needed, whichever
+    // pool needs them
+    char *x = pmalloc(a, 1);
+    char *y = pmalloc(b, 1);
+    char *z = pmalloc(c, 1);
+    char *w = pmalloc(a, os_page_size / 2);
+    w = pmalloc(a, os_page_size / 2);
+    assert((char *) a->head->next == group->arena.base);
+    assert((char *) b->head == group->arena.base + os_page_size);
+    assert((char *) c->head == group->arena.base + 2 * os_page_size);
+    assert((char *) a->head == group->arena.base + 3 * os_page_size);
+    *x = 'A';
+    *y = 'B';
+    *z = 'C';
+    *w = 'D';
+
+    // All four pages are sealed together
+    #if defined(PMALLOC_STATS)
+        pmalloc_global_stats_t before;
+        pmalloc_global_stats(&before);
+    #endif
+    pmalloc_protect_group(group);
+    #if defined(PMALLOC_STATS)
+        pmalloc_global_stats_t after;
+        pmalloc_global_stats(&after);
+        assert(after.protect_calls == before.protect_calls + 1);
+    #endif
+    assert(a->head->ro && a->head->next->ro);
+    assert(b->head->ro);
+    assert(c->head->ro);
+    assert(*x == 'A');
+    assert(*y == 'B');
+    assert(*z == 'C');
+    assert(*w == 'D');
+
+    // Members can still be protected and destroyed on their own
+    char *v = pmalloc(b, 1);
+    *v = 'E';
+    pmalloc_protect_pool(b);
+    assert(b->head->ro);
+    pmalloc_destroy_pool(b);
+    assert(group->members == c && c->group_next == a);
+
+    // The rest keep taking pages from the group
+    v = pmalloc(c, 1);
+    assert((char *) c->head == group->arena.base + 5 * os_page_size);
+    pmalloc_protect_group(group);
+    assert(c->head->ro);
+
+    pmalloc_destroy_group(group);
+    return 0;
+}
@@ -0,0 +1,34 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2022  Ammar Ratnani <ammrat13@gmail.com>
+
+#include <assert.h>
+#include <stdlib.h>
+#include <signal.h>
+
+#include "pmalloc/pmalloc.h"
+#include "pmalloc/internals.h"
+
+void segv_handler(int signal) {
+    assert(signal == SIGSEGV);
+    exit(0);
+}
+
+
+int main(void) {
+    signal(SIGSEGV, segv_handler);
+
+    pmalloc_group_t *group = pmalloc_create_group(0);
+    pmalloc_pool_attr_t attr;
+    pmalloc_pool_attr_init(&attr);
+    pmalloc_pool_t *a = pmalloc_create_group_pool(group, &attr);
+    pmalloc_pool_t *b = pmalloc_create_group_pool(group, &attr);
+
+    char *x = pmalloc(a, 1);
+    char *y = pmalloc(b, 1);
+    pmalloc_protect_group(group);
+    assert(*x == 0);
+
+    *y = 'B';
+
+    assert(false);
+}
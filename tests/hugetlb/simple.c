@@ -0,0 +1,41 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2022  Ammar Ratnani <ammrat13@gmail.com>
+
+#include <assert.h>
+#include <stdint.h>
+
+#include "pmalloc/pmalloc.h"
+#include "pmalloc/internals.h"
+
+
+int main(void) {
+    // Pages get huge pages whenever the system has some free. Otherwise, this
+    // checks the same things for normal pages.
+    const size_t os_page_size = pmalloc_get_page_size();
+    pmalloc_pool_t *pool = pmalloc_create_custom_pool(4 * os_page_size);
+    char *x = pmalloc(pool, 1);
+    *x = 'A';
+    pmalloc_page_header_t *page = pool->head;
+    assert(page->seal_size % os_page_size == 0);
+    assert(page->page_size % page->seal_size == 0);
+    assert((uintptr_t) page->base % page->seal_size == 0);
+
+    // Protection is only ever changed in whole huge pages
+    pmalloc_protect_pool(pool);
+    assert(*x == 'A');
+    assert(page->ro_offset % page->seal_size == 0
+        || page->ro_offset == page->page_size);
+    if (page->seal_size == page->page_size) {
+        assert(page->ro);
+    }
+
+    // Sealed objects can still be changed through the library
+    assert(pmalloc_rare_write(pool, x, "B", 1));
+    assert(*x == 'B');
+
+    // New objects are writable
+    char *y = pmalloc(pool, 1);
+    *y = 'C';
+    pmalloc_destroy_pool(pool);
+    return 0;
+}
@@ -0,0 +1,59 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2022  Ammar Ratnani <ammrat13@gmail.com>
+
+#include <assert.h>
+
+#include "pmalloc/pmalloc.h"
+#include "pmalloc/internals.h"
+
+
+int main(void) {
+    pmalloc_pool_t *a = pmalloc_create_pool();
+    pmalloc_pool_attr_t attr;
+    pmalloc_pool_attr_init(&attr);
+    attr.flags |= PMALLOC_POOL_EXTERNAL_HEADERS;
+    pmalloc_pool_t *b = pmalloc_create_attr_pool(&attr);
+
+    // Pointers anywhere in a page are found
+    char *x = pmalloc(a, 16);
+    char *y = pmalloc(b, 16);
+    assert(pmalloc_owner(x) == a);
+    assert(pmalloc_owner(x + 15) == a);
+    assert(pmalloc_owner(y) == b);
+    assert(pmalloc_owner(a->head->base) == a);
+    // Pointers outside pools aren't
+    int local = 0;
+    assert(pmalloc_owner(&local) == NULL);
+    assert(pmalloc_owner(NULL) == NULL);
+    assert(pmalloc_owner(a) == NULL);
+    assert(!pmalloc_is_protected(&local));
+
+    // Only sealed data counts as protected
+    assert(!pmalloc_is_protected(x));
+    pmalloc_protect_pool(a);
+    assert(pmalloc_is_protected(x));
+    assert(!pmalloc_is_protected(y));
+    char *z = pmalloc(a, 16);
+    assert(pmalloc_owner(z) == a);
+    assert(!pmalloc_is_protected(z));
+
+    #if defined(PMALLOC_MULTIPAGE_ALLOC)
+        char *w = pmalloc(b, 3 * PMALLOC_DEFAULT_PAGESIZE);
+        assert(pmalloc_owner(w) == b);
+        assert(pmalloc_owner(w + 3 * PMALLOC_DEFAULT_PAGESIZE - 1) == b);
+        pmalloc_protect_pool(b);
+        assert(pmalloc_is_protected(w));
+    #endif
+
+    // Reset pages are still in the pool, but they're writable again
+    pmalloc_reset_pool(a);
+    assert(pmalloc_owner(x) == a);
+    assert(!pmalloc_is_protected(x));
+
+    // Freed pages aren't in any pool
+    pmalloc_destroy_pool(b);
+    assert(pmalloc_owner(y) == NULL);
+    pmalloc_destroy_pool(a);
+    assert(pmalloc_owner(x) == NULL);
+    return 0;
+}
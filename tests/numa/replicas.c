@@ -0,0 +1,128 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2022  Ammar Ratnani <ammrat13@gmail.com>
+
+#include <assert.h>
+#include <string.h>
+
+#include "pmalloc/pmalloc.h"
+#include "pmalloc/internals.h"
+
+#if defined(PMALLOC_NUMA)
+#   include <limits.h>
+#   include <unistd.h>
+#   include <sys/syscall.h>
+#   include <linux/mempolicy.h>
+
+// The kernel takes node masks as arrays of these
+typedef unsigned long numa_word_t;  // NOLINT(runtime/int)
+#endif
+
+#define NUM_OBJECTS 1000
+
+
+/** \brief A linked list to build in each copy */
+typedef struct node_t {
+    struct node_t *next;
+    size_t value;
+} node_t;
+
+/** \brief Build a list of `NUM_OBJECTS` nodes, counting calls in `arg` */
+static void *build_list(pmalloc_pool_t *pool, void *arg) {
+    (*(size_t *) arg)++;
+    node_t *head = NULL;
+    for (size_t i = 0; i < NUM_OBJECTS; i++) {
+        node_t *const node = pmalloc(pool, sizeof(node_t));
+        node->next = head;
+        node->value = i;
+        head = node;
+    }
+    return head;
+}
+
+/** \brief Check that the page holding `ptr` follows a policy on node zero
+ *
+ * The kernel is asked directly. Nothing is checked if it doesn't support NUMA.
+ */
+static void check_placement(void *ptr, unsigned policy) {
+    #if defined(PMALLOC_NUMA)
+        numa_word_t mask[
+            PMALLOC_NUMA_MAXNODES / (CHAR_BIT * sizeof(numa_word_t))] = {0};
+        int mode;
+        if (syscall(
+                SYS_get_mempolicy, &mode, mask, PMALLOC_NUMA_MAXNODES, ptr,
+                MPOL_F_ADDR) != 0) {
+            return;
+        }
+        int node;
+        const long ret = syscall(  // NOLINT(runtime/int)
+            SYS_get_mempolicy, &node, NULL, 0, ptr,
+            MPOL_F_NODE | MPOL_F_ADDR);
+        assert(ret == 0);
+        (void) ret;
+        switch (policy) {
+            case PMALLOC_NUMA_BIND:
+                assert(mode == MPOL_BIND);
+                assert(mask[0] & 1);
+                assert(node == 0);
+                break;
+            case PMALLOC_NUMA_INTERLEAVE:
+                assert(mode == MPOL_INTERLEAVE);
+                break;
+            default:
+                break;
+        }
+    #else
+        (void) ptr;
+        (void) policy;
+    #endif
+}
+
+/** \brief Allocate across many pages in a pool with a NUMA policy */
+static void test_policy(unsigned policy, unsigned flags) {
+    pmalloc_pool_attr_t attr;
+    pmalloc_pool_attr_init(&attr);
+    attr.flags |= flags;
+    attr.numa_policy = policy;
+    pmalloc_pool_t *pool = pmalloc_create_attr_pool(&attr);
+    assert(pool);
+    char *first = pmalloc(pool, 64);
+    memset(first, 'A', 64);
+    for (size_t i = 1; i < NUM_OBJECTS; i++) {
+        memset(pmalloc(pool, 64), 'A', 64);
+    }
+    check_placement(first, policy);
+    pmalloc_protect_pool(pool);
+    pmalloc_destroy_pool(pool);
+}
+
+
+int main(void) {
+    test_policy(PMALLOC_NUMA_DEFAULT, 0);
+    test_policy(PMALLOC_NUMA_LOCAL, 0);
+    test_policy(PMALLOC_NUMA_BIND, 0);
+    test_policy(PMALLOC_NUMA_INTERLEAVE, 0);
+    test_policy(PMALLOC_NUMA_BIND, PMALLOC_POOL_ARENA);
+
+    // There's one copy for each node, and the local one is among them
+    pmalloc_pool_attr_t attr;
+    pmalloc_pool_attr_init(&attr);
+    size_t builds = 0;
+    pmalloc_replicas_t *replicas =
+        pmalloc_create_replicas(&attr, build_list, &builds);
+    assert(replicas);
+    #if defined(PMALLOC_NUMA)
+        assert(builds == (size_t) __builtin_popcountll(pmalloc_numa_nodes()));
+    #else
+        assert(builds == 1);
+    #endif
+    const node_t *list = pmalloc_local_replica(replicas);
+    size_t count = 0;
+    for (; list != NULL; list = list->next) {
+        assert(list->value == NUM_OBJECTS - 1 - count);
+        count++;
+    }
+    assert(count == NUM_OBJECTS);
+    pmalloc_destroy_replicas(replicas);
+
+    return 0;
+}
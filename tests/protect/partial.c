@@ -0,0 +1,67 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2022  Ammar Ratnani <ammrat13@gmail.com>
+
+#include <assert.h>
+
+#include "pmalloc/pmalloc.h"
+#include "pmalloc/internals.h"
+
+
+int main(void) {
+    const size_t os_page_size = pmalloc_get_page_size();
+    pmalloc_pool_t *pool = pmalloc_create_custom_pool(4 * os_page_size);
+    char *x = pmalloc(pool, 1);
+    *x = 'A';
+    pmalloc_page_header_t *page = pool->head;
+    const size_t end = page->page_size;
+
+    // Only the last OS page is sealed. The boundary pointer moves down to it.
+    pmalloc_protect_pool(pool);
+    assert(pool->head == page);
+    assert(page->ro == false);
+    assert(page->ro_offset == end - os_page_size);
+    assert(page->bp_offset == end - os_page_size);
+
+    // New allocations still go in the same page, and are writable
+    char *y = pmalloc(pool, os_page_size);
+    assert(pool->head == page);
+    assert(y == (char *) page + end - 2 * os_page_size);
+    *y = 'B';
+
+    // Protecting again only seals the new part
+    pmalloc_protect_pool(pool);
+    assert(page->ro == false);
+    assert(page->ro_offset == end - 2 * os_page_size);
+
+    // Filling the header's OS page seals the whole thing
+    char *z = pmalloc(pool, end - 3 * os_page_size);
+    *z = 'C';
+    pmalloc(pool, os_page_size / 2);
+    pmalloc_protect_pool(pool);
+    assert(page->ro == true);
+    assert(page->ro_offset == 0);
+
+    // A page that's retired while it's partly sealed is sealed once more.
+    // After that, protecting doesn't look at it again.
+    char *w = pmalloc(pool, 1);
+    *w = 'D';
+    pmalloc_page_header_t *second = pool->head;
+    assert(second != page);
+    pmalloc_protect_pool(pool);
+    assert(second->ro == false);
+    char *v = pmalloc(pool, end - os_page_size);
+    assert(pool->head != second);
+    *v = 'E';
+    pmalloc_protect_pool(pool);
+    assert(pool->sealed == second);
+    assert(second->ro == false);
+
+    assert(*x == 'A');
+    assert(*y == 'B');
+    assert(*z == 'C');
+    assert(*w == 'D');
+    assert(*v == 'E');
+
+    pmalloc_destroy_pool(pool);
+    return 0;
+}
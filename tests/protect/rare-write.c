@@ -0,0 +1,87 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2022  Ammar Ratnani <ammrat13@gmail.com>
+
+#include <assert.h>
+#include <string.h>
+
+#include "pmalloc/pmalloc.h"
+#include "pmalloc/internals.h"
+
+
+/** \brief Write to protected objects in a pool created with `flags` */
+static void test_pool(unsigned flags) {
+    pmalloc_pool_attr_t attr;
+    pmalloc_pool_attr_init(&attr);
+    attr.flags |= flags;
+    attr.arena_size = 4 * PMALLOC_DEFAULT_PAGESIZE;
+    pmalloc_pool_t *pool = pmalloc_create_attr_pool(&attr);
+    assert(pool);
+
+    char *x = pmalloc(pool, 16);
+    memcpy(x, "before", sizeof("before"));
+    char local[16];
+
+    // Objects can be written before and after they're protected
+    assert(pmalloc_rare_write(pool, x, "during", 7));
+    assert(strcmp(x, "during") == 0);
+    pmalloc_protect_pool(pool);
+    assert(pmalloc_rare_write(pool, x, "after", 6));
+    assert(strcmp(x, "after") == 0);
+
+    // Objects allocated after protection are still writable directly
+    char *y = pmalloc(pool, 16);
+    assert(pmalloc_rare_write(pool, y, "new", 4));
+    memcpy(y, "newer", sizeof("newer"));
+    assert(pmalloc_rare_write(pool, x, "again", 6));
+    assert(strcmp(x, "again") == 0);
+    assert(strcmp(y, "newer") == 0);
+
+    // Memory outside the pool can't be written
+    assert(!pmalloc_rare_write(pool, local, "no", 3));
+
+    pmalloc_destroy_pool(pool);
+}
+
+#if defined(PMALLOC_MEMFD)
+/** \brief Write through the alias when pages don't start on a page boundary
+ *
+ * The superblock of a shared pool comes first, so every page is shifted from
+ * where it would be in a normal arena.
+ */
+static void test_shifted_pages(void) {
+    pmalloc_pool_attr_t attr;
+    pmalloc_pool_attr_init(&attr);
+    attr.page_size = 4 * PMALLOC_DEFAULT_PAGESIZE;
+    attr.flags |= PMALLOC_POOL_SHARED | PMALLOC_POOL_WRITE_RARE;
+    attr.arena_size = 16 * PMALLOC_DEFAULT_PAGESIZE;
+    pmalloc_pool_t *pool = pmalloc_create_attr_pool(&attr);
+    assert(pool);
+
+    // The object spans where a page boundary would be without the superblock
+    const size_t size = 3 * PMALLOC_DEFAULT_PAGESIZE;
+    char *x = pmalloc(pool, size);
+    assert(x);
+    pmalloc_protect_pool(pool);
+    char buf[3 * PMALLOC_DEFAULT_PAGESIZE];
+    memset(buf, 'A', size);
+    assert(pmalloc_rare_write(pool, x, buf, size));
+    assert(x[0] == 'A' && x[size - 1] == 'A');
+
+    // Writes still can't run past the end of the page
+    assert(!pmalloc_rare_write(pool, x + size - 1, "no", 2));
+
+    pmalloc_destroy_pool(pool);
+}
+#endif
+
+
+int main(void) {
+    test_pool(0);
+    test_pool(PMALLOC_POOL_EXTERNAL_HEADERS);
+    test_pool(PMALLOC_POOL_WRITE_RARE);
+    test_pool(PMALLOC_POOL_WRITE_RARE | PMALLOC_POOL_EXTERNAL_HEADERS);
+    #if defined(PMALLOC_MEMFD)
+        test_shifted_pages();
+    #endif
+    return 0;
+}
@@ -0,0 +1,40 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2022  Ammar Ratnani <ammrat13@gmail.com>
+
+#include <assert.h>
+#include <stdlib.h>
+#include <signal.h>
+
+#include "pmalloc/pmalloc.h"
+#include "pmalloc/internals.h"
+
+void segv_handler(int signal) {
+    assert(signal == SIGSEGV);
+    exit(0);
+}
+
+
+int main(void) {
+    signal(SIGSEGV, segv_handler);
+
+    pmalloc_pool_attr_t attr;
+    pmalloc_pool_attr_init(&attr);
+    attr.flags |= PMALLOC_POOL_THREAD_CACHE;
+    pmalloc_pool_t *pool = pmalloc_create_attr_pool(&attr);
+
+    // Both of these come from the same cached chunk
+    char *x = pmalloc(pool, 1);
+    char *y = pmalloc(pool, 1);
+    assert(y < x);
+    *y = 'B';
+
+    // The chunk is thrown away after protecting, so this must be writable
+    pmalloc_protect_pool(pool);
+    char *z = pmalloc(pool, 1);
+    *z = 'C';
+    assert(*y == 'B');
+
+    *x = 'A';
+
+    assert(false);
+}
@@ -0,0 +1,62 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2022  Ammar Ratnani <ammrat13@gmail.com>
+
+#include <assert.h>
+#include <string.h>
+
+#include "pmalloc/pmalloc.h"
+#include "pmalloc/internals.h"
+
+
+/** \brief Start a page and move on to the next one, then dirty its free space
+ * \param [out] x The object left in the page
+ * \return The page that was left behind
+ */
+static pmalloc_page_header_t *abandon_page(pmalloc_pool_t *pool, char **x) {
+    *x = pmalloc(pool, 1);
+    **x = 'A';
+    pmalloc_page_header_t *const page = pool->head;
+    char *y = pmalloc(pool, pool->page_size - pool->header_size);
+    *y = 'B';
+    assert(pool->head != page);
+    memset(page->base + pool->header_size, 'X',
+        page->bp_offset - pool->header_size);
+    return page;
+}
+
+
+int main(void) {
+    const size_t os_page_size = pmalloc_get_page_size();
+
+    // The free space of a page that's no longer the head can be released
+    pmalloc_pool_t *pool = pmalloc_create_custom_pool(8 * os_page_size);
+    char *x;
+    pmalloc_page_header_t *page = abandon_page(pool, &x);
+    assert(pmalloc_trim_pool(pool) == 6 * os_page_size);
+    assert(page->bp_offset == os_page_size);
+    assert(page->base[2 * os_page_size] != 'X');
+    assert(*x == 'A');
+    // There's nothing left to release, and the head is still writable
+    assert(pmalloc_trim_pool(pool) == 0);
+    char *z = pmalloc(pool, 1);
+    *z = 'C';
+    pmalloc_destroy_pool(pool);
+
+    // Pools can be trimmed every time they're protected
+    pmalloc_pool_attr_t attr;
+    pmalloc_pool_attr_init(&attr);
+    attr.page_size = 8 * os_page_size;
+    attr.flags |= PMALLOC_POOL_TRIM;
+    pool = pmalloc_create_attr_pool(&attr);
+    page = abandon_page(pool, &x);
+    pmalloc_protect_pool(pool);
+    assert(page->bp_offset == os_page_size);
+    assert(*x == 'A');
+    #if defined(PMALLOC_STATS)
+        pmalloc_stats_t stats;
+        pmalloc_pool_stats(pool, &stats);
+        assert(stats.trimmed_bytes == 6 * os_page_size);
+    #endif
+    pmalloc_destroy_pool(pool);
+    return 0;
+}
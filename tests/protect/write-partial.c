@@ -0,0 +1,31 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2022  Ammar Ratnani <ammrat13@gmail.com>
+
+#include <assert.h>
+#include <stdlib.h>
+#include <signal.h>
+
+#include "pmalloc/pmalloc.h"
+#include "pmalloc/internals.h"
+
+void segv_handler(int signal) {
+    assert(signal == SIGSEGV);
+    exit(0);
+}
+
+
+int main(void) {
+    signal(SIGSEGV, segv_handler);
+
+    const size_t os_page_size = pmalloc_get_page_size();
+    pmalloc_pool_t *pool = pmalloc_create_custom_pool(4 * os_page_size);
+
+    char *x = pmalloc(pool, 1);
+    pmalloc_protect_pool(pool);
+    char *y = pmalloc(pool, 1);
+    *y = 'B';
+
+    *x = 'A';
+
+    assert(false);
+}
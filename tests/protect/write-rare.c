@@ -0,0 +1,33 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2022  Ammar Ratnani <ammrat13@gmail.com>
+
+#include <assert.h>
+#include <stdlib.h>
+#include <signal.h>
+
+#include "pmalloc/pmalloc.h"
+#include "pmalloc/internals.h"
+
+void segv_handler(int signal) {
+    assert(signal == SIGSEGV);
+    exit(0);
+}
+
+
+int main(void) {
+    signal(SIGSEGV, segv_handler);
+
+    pmalloc_pool_attr_t attr;
+    pmalloc_pool_attr_init(&attr);
+    attr.flags |= PMALLOC_POOL_WRITE_RARE;
+    pmalloc_pool_t *pool = pmalloc_create_attr_pool(&attr);
+    char *x = pmalloc(pool, 1);
+
+    // Writing through the alias doesn't make the object writable
+    pmalloc_protect_pool(pool);
+    assert(pmalloc_rare_write(pool, x, "A", 1));
+    assert(*x == 'A');
+    *x = 'B';
+
+    assert(false);
+}
@@ -0,0 +1,33 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2022  Ammar Ratnani <ammrat13@gmail.com>
+
+#include <assert.h>
+#include <stdlib.h>
+#include <signal.h>
+
+#include "pmalloc/pmalloc.h"
+#include "pmalloc/internals.h"
+
+void segv_handler(int signal) {
+    assert(signal == SIGSEGV);
+    exit(0);
+}
+
+
+int main(void) {
+    signal(SIGSEGV, segv_handler);
+
+    pmalloc_pool_t *pool = pmalloc_create_pool();
+    char *x = pmalloc(pool, 1);
+    pmalloc_protect_pool(pool);
+
+    // Writes are allowed inside the window, but not after it's closed
+    void *page = pool->head->base;
+    pmalloc_write_begin(page, pool->head->page_size);
+    *x = 'A';
+    pmalloc_write_end(page, pool->head->page_size);
+    assert(*x == 'A');
+    *x = 'B';
+
+    assert(false);
+}
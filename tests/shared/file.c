@@ -0,0 +1,65 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2022  Ammar Ratnani <ammrat13@gmail.com>
+
+#include <assert.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "pmalloc/pmalloc.h"
+#include "pmalloc/internals.h"
+
+#define NUM_VALUES 10000
+
+
+int main(void) {
+    char path[] = "/tmp/pmalloc-test-XXXXXX";
+    int fd = mkstemp(path);
+    assert(fd >= 0);
+    close(fd);
+
+    // Fill a file with values. They span many pages.
+    pmalloc_pool_attr_t attr;
+    pmalloc_pool_attr_init(&attr);
+    pmalloc_pool_t *pool = pmalloc_create_file_pool(path, &attr);
+    assert(pool);
+    size_t *values[NUM_VALUES / 100];
+    for (size_t i = 0; i < NUM_VALUES / 100; i++) {
+        values[i] = pmalloc(pool, 100 * sizeof(size_t));
+        assert(values[i]);
+        for (size_t j = 0; j < 100; j++) {
+            values[i][j] = i * 100 + j;
+        }
+    }
+    // The root is the last chunk, with the offsets of the others in front
+    size_t *offsets = pmalloc(pool, sizeof(values));
+    for (size_t i = 0; i < NUM_VALUES / 100; i++) {
+        offsets[i] = (char *) values[i] - (char *) offsets;
+    }
+    pmalloc_set_root(pool, offsets);
+    pmalloc_protect_pool(pool);
+    pmalloc_flush_pool(pool);
+    pmalloc_destroy_pool(pool);
+
+    // Open it again. Everything is where it was relative to the root.
+    pool = pmalloc_open_file_pool(path);
+    assert(pool);
+    assert(pmalloc(pool, 16) == NULL);
+    offsets = pmalloc_get_root(pool);
+    assert(offsets);
+    for (size_t i = 0; i < NUM_VALUES / 100; i++) {
+        size_t *chunk = (size_t *) ((char *) offsets + offsets[i]);
+        for (size_t j = 0; j < 100; j++) {
+            assert(chunk[j] == i * 100 + j);
+        }
+    }
+    pmalloc_destroy_pool(pool);
+
+    // Files that aren't pools can't be opened
+    fd = open(path, O_WRONLY | O_TRUNC);
+    close(fd);
+    assert(pmalloc_open_file_pool(path) == NULL);
+
+    unlink(path);
+    return 0;
+}
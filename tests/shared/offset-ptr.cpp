@@ -0,0 +1,66 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2022  Ammar Ratnani <ammrat13@gmail.com>
+
+#include <unistd.h>
+
+#include <cassert>
+#include <cstdlib>
+#include <new>
+
+#include "pmalloc/pmalloc.h"
+#include "pmalloc/offset_ptr.hpp"
+
+#define NUM_NODES 1000
+
+
+struct node_t {
+    pmalloc::offset_ptr<node_t> next;
+    size_t value;
+};
+
+
+int main() {
+    char path[] = "/tmp/pmalloc-test-XXXXXX";
+    int fd = mkstemp(path);
+    assert(fd >= 0);
+    close(fd);
+
+    // Null pointers stay null when copied
+    pmalloc::offset_ptr<node_t> null;
+    pmalloc::offset_ptr<node_t> copy = null;
+    assert(!copy);
+    assert(copy.get() == nullptr);
+
+    // Build a list in a file
+    pmalloc_pool_attr_t attr;
+    pmalloc_pool_attr_init(&attr);
+    pmalloc_pool_t *pool = pmalloc_create_file_pool(path, &attr);
+    assert(pool);
+    node_t *head = nullptr;
+    for (size_t i = 0; i < NUM_NODES; i++) {
+        node_t *n = new (pmalloc_align(pool, sizeof(node_t), 3)) node_t;
+        n->next = head;
+        n->value = i;
+        head = n;
+    }
+    assert(head->next->value == NUM_NODES - 2);
+    pmalloc_set_root(pool, head);
+    pmalloc_flush_pool(pool);
+
+    // Open it while the original is still mapped, so it has to be mapped
+    // somewhere else
+    pmalloc_pool_t *opened = pmalloc_open_file_pool(path);
+    assert(opened);
+    node_t *opened_head = static_cast<node_t *>(pmalloc_get_root(opened));
+    assert(opened_head != head);
+    size_t expected = NUM_NODES;
+    for (node_t *n = opened_head; n != nullptr; n = n->next.get()) {
+        assert(n->value == --expected);
+    }
+    assert(expected == 0);
+
+    pmalloc_destroy_pool(opened);
+    pmalloc_destroy_pool(pool);
+    unlink(path);
+    return 0;
+}
@@ -0,0 +1,140 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2022  Ammar Ratnani <ammrat13@gmail.com>
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "pmalloc/pmalloc.h"
+#include "pmalloc/internals.h"
+
+#define NUM_NODES 1000
+
+
+typedef struct node_t {
+    struct node_t *next;
+    size_t value;
+} node_t;
+
+
+/** \brief Send a file descriptor over a UNIX socket */
+static void send_fd(int sock, int fd) {
+    char byte = 0;
+    struct iovec iov = {&byte, 1};
+    char control[CMSG_SPACE(sizeof(int))] = {0};
+    struct msghdr msg = {0};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    ssize_t ret = sendmsg(sock, &msg, 0);
+    assert(ret == 1);
+}
+
+/** \brief Receive a file descriptor sent with send_fd() */
+static int recv_fd(int sock) {
+    char byte;
+    struct iovec iov = {&byte, 1};
+    char control[CMSG_SPACE(sizeof(int))];
+    struct msghdr msg = {0};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if (recvmsg(sock, &msg, 0) != 1) {
+        return -1;
+    }
+    int fd;
+    memcpy(&fd, CMSG_DATA(CMSG_FIRSTHDR(&msg)), sizeof(int));
+    return fd;
+}
+
+
+/** \brief Attach to the pool and check the list in it */
+static int worker(int sock) {
+    const int fd = recv_fd(sock);
+    if (fd < 0) {
+        return 1;
+    }
+    pmalloc_pool_t *pool = pmalloc_attach_pool(fd);
+    close(fd);
+    if (pool == NULL) {
+        return 2;
+    }
+    // Attached pools can't allocate
+    if (pmalloc(pool, 16) != NULL) {
+        return 3;
+    }
+    size_t expected = NUM_NODES;
+    for (node_t *n = pmalloc_get_root(pool); n != NULL; n = n->next) {
+        if (n->value != --expected) {
+            return 4;
+        }
+    }
+    if (expected != 0) {
+        return 5;
+    }
+    pmalloc_destroy_pool(pool);
+    return 0;
+}
+
+
+int main(void) {
+    // Fork first, so the pool's address is free in the worker
+    int socks[2];
+    int ret = socketpair(AF_UNIX, SOCK_STREAM, 0, socks);
+    assert(ret == 0);
+    const pid_t pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+        close(socks[0]);
+        exit(worker(socks[1]));
+    }
+    close(socks[1]);
+
+    // Build a list and protect it
+    pmalloc_pool_attr_t attr;
+    pmalloc_pool_attr_init(&attr);
+    attr.flags |= PMALLOC_POOL_SHARED;
+    pmalloc_pool_t *pool = pmalloc_create_attr_pool(&attr);
+    assert(pool);
+    assert(pmalloc_pool_fd(pool) >= 0);
+    node_t *head = NULL;
+    for (size_t i = 0; i < NUM_NODES; i++) {
+        node_t *n = pmalloc(pool, sizeof(node_t));
+        assert(n);
+        n->next = head;
+        n->value = i;
+        head = n;
+    }
+    // Objects bigger than a page come from the arena too
+    #if defined(PMALLOC_MULTIPAGE_ALLOC)
+        char *big = pmalloc(pool, 2 * PMALLOC_DEFAULT_PAGESIZE);
+        assert(pmalloc_in_arena(&pool->arena, big));
+    #endif
+    pmalloc_set_root(pool, head);
+    assert(pmalloc_get_root(pool) == head);
+    pmalloc_protect_pool(pool);
+
+    // Hand it to the worker
+    send_fd(socks[0], pmalloc_pool_fd(pool));
+    int status;
+    pid_t waited = waitpid(pid, &status, 0);
+    assert(waited == pid);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    // Files that aren't pools can't be attached to
+    assert(pmalloc_attach_pool(socks[0]) == NULL);
+
+    close(socks[0]);
+    pmalloc_destroy_pool(pool);
+    return 0;
+}
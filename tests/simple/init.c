@@ -0,0 +1,30 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2022  Ammar Ratnani <ammrat13@gmail.com>
+
+#include <assert.h>
+#include <stdint.h>
+
+#include "pmalloc/pmalloc.h"
+#include "pmalloc/internals.h"
+
+
+int main(void) {
+    // Initializing again doesn't do anything
+    pmalloc_init();
+    pmalloc_init();
+
+    // Pages of all sizes still work, whatever page sizes were found
+    const size_t os_page_size = pmalloc_get_page_size();
+    pmalloc_pool_t *pool = pmalloc_create_custom_pool(1ull << 22);
+    for (size_t size = 1; size <= (1ull << 20); size <<= 2) {
+        char *x = pmalloc(pool, size);
+        assert(x);
+        assert(pool->head->page_size >= size);
+        assert((uintptr_t) pool->head % os_page_size == 0);
+        x[0] = 'A';
+        x[size - 1] = 'B';
+    }
+    pmalloc_protect_pool(pool);
+    pmalloc_destroy_pool(pool);
+    return 0;
+}
@@ -0,0 +1,66 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2022  Ammar Ratnani <ammrat13@gmail.com>
+
+#include <assert.h>
+
+#include "pmalloc/pmalloc.h"
+#include "pmalloc/internals.h"
+
+
+int main(void) {
+    pmalloc_global_stats_t global_before;
+    pmalloc_global_stats(&global_before);
+
+    const size_t os_page_size = pmalloc_get_page_size();
+    pmalloc_pool_t *pool = pmalloc_create_custom_pool(4 * os_page_size);
+    pmalloc_stats_t stats;
+    pmalloc_pool_stats(pool, &stats);
+    assert(stats.pages == 0);
+    assert(stats.allocations == 0);
+
+    // Objects that need padding count it as waste
+    pmalloc_align(pool, 3, 0);
+    pmalloc_align(pool, 8, 3);
+    pmalloc_pool_stats(pool, &stats);
+    assert(stats.pages == 1);
+    assert(stats.page_bytes == pool->head->page_size);
+    assert(stats.map_calls == 1);
+    assert(stats.allocations == 2);
+    assert(stats.allocated_bytes == 11);
+    assert(stats.waste_alignment == 5);
+    assert(stats.waste_page_tail == 0);
+
+    // Protecting seals the free space in the OS page with the objects
+    pmalloc_protect_pool(pool);
+    pmalloc_pool_stats(pool, &stats);
+    assert(stats.protects == 1);
+    assert(stats.protect_calls == 1);
+    assert(stats.waste_protect == os_page_size - 16);
+
+    // Starting a new page abandons what's left of the old one
+    const size_t left = pool->head->bp_offset - pool->header_size;
+    pmalloc_align(pool, left + 1, 0);
+    pmalloc_pool_stats(pool, &stats);
+    assert(stats.pages == 2);
+    assert(stats.waste_page_tail == left);
+
+    // Everything in the pages is accounted for
+    size_t free_bytes = pool->head->bp_offset - pool->header_size;
+    assert(
+        stats.page_bytes ==
+        stats.pages * pool->header_size + stats.allocated_bytes
+        + stats.waste_alignment + stats.waste_page_tail + stats.waste_protect
+        + free_bytes);
+
+    pmalloc_global_stats_t global;
+    pmalloc_global_stats(&global);
+    assert(global.pools == global_before.pools + 1);
+    assert(global.pages == global_before.pages + 2);
+    assert(global.protect_calls >= global_before.protect_calls + 1);
+    pmalloc_destroy_pool(pool);
+    pmalloc_global_stats(&global);
+    assert(global.pools == global_before.pools);
+    assert(global.pages == global_before.pages);
+    assert(global.page_bytes == global_before.page_bytes);
+    return 0;
+}
@@ -0,0 +1,51 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (C) 2022  Ammar Ratnani <ammrat13@gmail.com>
+
+#include <assert.h>
+#include <stdint.h>
+
+#include "pmalloc/pmalloc.h"
+#include "pmalloc/internals.h"
+
+
+int main(void) {
+    // Pages that are big enough are whole, aligned huge pages
+    pmalloc_pool_t *pool = pmalloc_create_custom_pool(PMALLOC_THP_SIZE - 1);
+    char *x = pmalloc(pool, 1);
+    *x = 'A';
+    assert((uintptr_t) pool->head % PMALLOC_THP_SIZE == 0);
+    assert(pool->head->page_size == PMALLOC_THP_SIZE);
+    char *y = pmalloc(pool, PMALLOC_THP_SIZE + 1);
+    *y = 'B';
+    assert((uintptr_t) pool->large % PMALLOC_THP_SIZE == 0);
+    assert(pool->large->page_size == 2 * PMALLOC_THP_SIZE);
+
+    // Protection still works
+    pmalloc_protect_pool(pool);
+    assert(*x == 'A');
+    assert(*y == 'B');
+    pmalloc_destroy_pool(pool);
+
+    // Small pages are left alone
+    pool = pmalloc_create_pool();
+    x = pmalloc(pool, 1);
+    assert(pool->head->page_size < PMALLOC_THP_SIZE);
+    pmalloc_destroy_pool(pool);
+
+    // Arenas are rounded up and aligned to whole huge pages
+    pmalloc_pool_attr_t attr;
+    pmalloc_pool_attr_init(&attr);
+    attr.flags |= PMALLOC_POOL_ARENA;
+    attr.arena_size = PMALLOC_THP_SIZE + 1;
+    pool = pmalloc_create_attr_pool(&attr);
+    assert((uintptr_t) pool->arena.base % PMALLOC_THP_SIZE == 0);
+    assert(pool->arena.size == 2 * PMALLOC_THP_SIZE);
+    x = pmalloc(pool, 1);
+    *x = 'C';
+    assert(pmalloc_in_arena(&pool->arena, x));
+    pmalloc_protect_pool(pool);
+    assert(*x == 'C');
+    pmalloc_destroy_pool(pool);
+
+    return 0;
+}